@@ -0,0 +1,993 @@
+#pragma once
+
+#include <fstream>
+#include <sstream>
+#include <vector>
+#include <string>
+#include <unordered_map>
+#include <map>
+#include <stdexcept>
+#include <cstdint>
+#include <cmath>
+#include <limits>
+#include <algorithm>
+
+#include "plink2_reader.h"
+#include "parallel.h"
+#include "linear_algebra.h"
+#include "statistics.h"
+
+// Phenotype or covariate value; "NA", "nan", "-9" and empty fields are missing (NaN)
+inline double parsePhenotypeValue(const std::string& text)
+{
+	if (text.empty() || text == "NA" || text == "nan" || text == "NaN" || text == "-9")
+		return std::numeric_limits<double>::quiet_NaN();
+
+	size_t used = 0;
+	const double value = std::stod(text, &used);
+
+	if (used != text.size())
+		throw std::runtime_error("Invalid phenotype value " + text);
+
+	return value;
+}
+
+// One .psam column as a single-column matrix, NaN where missing
+inline void readPhenotypeColumn(Plink2Reader& reader, const std::string& column, Matrix& values)
+{
+	std::vector<std::string> fields;
+	reader.readSampleColumn(column, fields);
+
+	values = Matrix(static_cast<uint32_t>(fields.size()), 1);
+
+	for (uint32_t sample = 0; sample < fields.size(); ++sample)
+		values(sample, 0) = parsePhenotypeValue(fields[sample]);
+}
+
+// Whitespace-delimited table keyed by sample: a '#' header naming the columns
+// (FID and IID, or IID alone) and one row per sample, e.g. a .eigenvec file.
+// Every other column is read into a (sample_count x column) matrix in .psam
+// order; samples absent from the file are NaN.
+inline void readSampleTable(Plink2Reader& reader, const std::string& path, Matrix& values, std::vector<std::string>& names)
+{
+	std::ifstream file(path);
+
+	if (!file.is_open())
+		throw std::runtime_error("Failed to open " + path);
+
+	std::string line;
+	std::vector<std::string> header;
+
+	if (!std::getline(file, line) || line.empty() || line[0] != '#')
+		throw std::runtime_error(path + " has no '#' header line");
+
+	std::istringstream header_stream(line.substr(1));
+
+	for (std::string field; header_stream >> field; )
+		header.push_back(field);
+
+	const auto fid_it = std::find(header.begin(), header.end(), "FID");
+	const auto iid_it = std::find(header.begin(), header.end(), "IID");
+
+	if (iid_it == header.end())
+		throw std::runtime_error(path + " has no IID column");
+
+	const bool keyed_by_fid = fid_it != header.end();
+	const size_t fid_index = keyed_by_fid ? fid_it - header.begin() : 0;
+	const size_t iid_index = iid_it - header.begin();
+
+	// Match on FID and IID when both sides have them, else on IID alone
+	std::vector<std::string> keys;
+	bool match_fid = false;
+
+	if (keyed_by_fid)
+		match_fid = readSampleLabels(reader, keys);
+	else
+		reader.readSampleIds(keys);
+
+	std::unordered_map<std::string, uint32_t> sample_index;
+
+	for (uint32_t sample = 0; sample < keys.size(); ++sample)
+	{
+		if (!sample_index.emplace(keys[sample], sample).second)
+			throw std::runtime_error("Duplicate sample ID " + keys[sample] + " in .psam; " + path + " cannot be matched");
+	}
+
+	names.clear();
+	std::vector<size_t> value_columns;
+
+	for (size_t column = 0; column < header.size(); ++column)
+	{
+		if (column == iid_index || (keyed_by_fid && column == fid_index))
+			continue;
+
+		names.push_back(header[column]);
+		value_columns.push_back(column);
+	}
+
+	values = Matrix(reader.sample_count, static_cast<uint32_t>(names.size()));
+	std::fill(values.data.begin(), values.data.end(), std::numeric_limits<double>::quiet_NaN());
+
+	std::vector<std::string> fields;
+
+	while (std::getline(file, line))
+	{
+		std::istringstream stream(line);
+		fields.clear();
+
+		for (std::string field; stream >> field; )
+			fields.push_back(field);
+
+		if (fields.empty())
+			continue;
+
+		if (fields.size() != header.size())
+			throw std::runtime_error("Malformed line in " + path);
+
+		const std::string key = match_fid ? fields[fid_index] + '\t' + fields[iid_index] : fields[iid_index];
+		const auto it = sample_index.find(key);
+
+		if (it == sample_index.end())
+			continue;
+
+		for (size_t c = 0; c < value_columns.size(); ++c)
+			values(it->second, static_cast<uint32_t>(c)) = parsePhenotypeValue(fields[value_columns[c]]);
+	}
+}
+
+struct AssociationResult {
+	uint32_t variant;
+
+	// Samples in the fit (OBS_CT); missing calls are mean-imputed and stay in
+	uint32_t observed;
+	double beta;
+	double se;
+	double statistic;
+	double p;
+};
+
+// Samples with every phenotype and covariate, registered as the reader's
+// sample subset, with an orthonormal basis of [1, covariates] over them
+class CovariateBasis {
+private:
+	void build(const Matrix& covariates)
+	{
+		const uint32_t n = static_cast<uint32_t>(included.size());
+		Matrix design(n, covariates.cols + 1);
+
+		for (uint32_t i = 0; i < n; ++i)
+		{
+			design(i, 0) = 1.0;
+
+			for (uint32_t c = 0; c < covariates.cols; ++c)
+				design(i, c + 1) = covariates(included[i], c);
+		}
+
+		// Collinear covariates collapse to zero columns and are dropped
+		orthonormalizeColumns(design);
+
+		std::vector<uint32_t> kept;
+
+		for (uint32_t c = 0; c < design.cols; ++c)
+		{
+			double norm = 0.0;
+
+			for (uint32_t i = 0; i < n; ++i)
+				norm += design(i, c) * design(i, c);
+
+			if (norm > 0.5)
+				kept.push_back(c);
+		}
+
+		rank = static_cast<uint32_t>(kept.size());
+		basis = Matrix(n, rank);
+
+		for (uint32_t i = 0; i < n; ++i)
+		{
+			for (uint32_t c = 0; c < rank; ++c)
+				basis(i, c) = design(i, kept[c]);
+		}
+	}
+
+public:
+	std::vector<uint64_t> include_mask;
+	std::vector<uint32_t> included;
+
+	// included x rank, orthonormal columns spanning the intercept and covariates
+	Matrix basis;
+	uint32_t rank;
+
+	CovariateBasis() : rank(0) {}
+
+	CovariateBasis(Plink2Reader& reader, const Matrix& phenotypes, const Matrix& covariates)
+		: include_mask((reader.sample_count + 63) / 64, 0), rank(0)
+	{
+		if (phenotypes.rows != reader.sample_count || (covariates.cols && covariates.rows != reader.sample_count))
+			throw std::invalid_argument("Phenotypes and covariates must cover every sample");
+
+		for (uint32_t sample = 0; sample < reader.sample_count; ++sample)
+		{
+			bool usable = true;
+
+			for (uint32_t c = 0; c < phenotypes.cols && usable; ++c)
+				usable = !std::isnan(phenotypes(sample, c));
+
+			for (uint32_t c = 0; c < covariates.cols && usable; ++c)
+				usable = !std::isnan(covariates(sample, c));
+
+			if (!usable)
+				continue;
+
+			include_mask[sample / 64] |= 1ULL << (sample % 64);
+			included.push_back(sample);
+		}
+
+		build(covariates);
+		reader.setSampleSubset(include_mask);
+	}
+
+	// Basis over the given samples (in .psam order), leaving the reader's subset alone
+	CovariateBasis(const std::vector<uint64_t>& mask, const Matrix& covariates)
+		: include_mask(mask), rank(0)
+	{
+		for (uint32_t word = 0; word < mask.size(); ++word)
+		{
+			for (uint64_t bits = mask[word]; bits; bits &= bits - 1)
+				included.push_back(word * 64 + static_cast<uint32_t>(__builtin_ctzll(bits)));
+		}
+
+		build(covariates);
+	}
+
+	// v minus its projection on the covariate space
+	void residualize(std::vector<double>& v) const
+	{
+		for (uint32_t c = 0; c < rank; ++c)
+		{
+			double dot = 0.0;
+
+			for (uint32_t i = 0; i < basis.rows; ++i)
+				dot += basis(i, c) * v[i];
+
+			for (uint32_t i = 0; i < basis.rows; ++i)
+				v[i] -= dot * basis(i, c);
+		}
+	}
+};
+
+// For every variant, sums of the rows of w over the samples carrying each
+// genotype code 1..3 (het, hom alt, missing); sums holds three w.cols-wide
+// rows. Only non-hom-ref fields of the packed row are visited (hom ref has
+// dosage 0 and contributes nothing), so a block of rare variants costs little
+// more than its carriers.
+inline void accumulateCodeSums(const uint64_t* row, uint32_t words, const Matrix& w, double* sums)
+{
+	const uint32_t width = w.cols;
+
+	std::fill(sums, sums + 3 * static_cast<size_t>(width), 0.0);
+
+	for (uint32_t word = 0; word < words; ++word)
+	{
+		const uint64_t fields = row[word];
+		uint64_t nonzero = (fields | (fields >> 1)) & kMask5555;
+
+		while (nonzero)
+		{
+			const uint32_t bit = static_cast<uint32_t>(__builtin_ctzll(nonzero));
+			const uint32_t code = static_cast<uint32_t>((fields >> bit) & 3);
+
+			addToRow(sums + static_cast<size_t>(code - 1) * width, w.row(word * kGenotypesPerWord + bit / 2), width);
+
+			nonzero &= nonzero - 1;
+		}
+	}
+}
+
+struct LinearOptions {
+	uint32_t block_variants = 1024;
+	uint32_t thread_count = 1;
+};
+
+// Additive-model linear regression of quantitative phenotypes on each
+// variant's ALT dosage (missing calls mean-imputed), adjusted for covariates.
+// Covariates are projected out once: with Q an orthonormal basis of
+// [1, covariates] and R the phenotype residuals, each variant g needs only
+// g.R, Q^T g and g.g, i.e. one product of the block's dosages with the
+// sample x (phenotypes + rank) panel [R Q], accumulated per genotype code.
+//
+// Phenotypes are grouped by which samples have them (with every covariate),
+// so each is tested on all of its own samples whatever other traits are
+// missing. Every group has its own basis and a panel [1 R Q] that is zero
+// outside the group, where the indicator column yields the group's genotype
+// counts; the panels sit side by side over the union of the groups' samples,
+// so decoding and the sparse walk over each row are shared by all phenotypes.
+// The walk costs one panel width per carrier, which grows with the number of
+// distinct missingness patterns.
+class LinearAssociation {
+private:
+	// Phenotypes with one missingness pattern, at panel columns
+	// [column, column + 1 + phenotypes + rank): indicator, residuals, basis
+	struct PhenotypeGroup {
+		std::vector<uint32_t> phenotypes;
+		CovariateBasis covariates;
+		uint32_t column;
+	};
+
+	Plink2Reader& reader;
+	LinearOptions options;
+	uint32_t phenotype_count;
+	std::vector<PhenotypeGroup> groups;
+
+	// Samples of any group, registered as the reader's sample subset
+	uint32_t sample_count;
+
+	// The groups' panels over the subset, and each residual's sum of squares
+	Matrix panel;
+	std::vector<double> residual_ss;
+
+	// Fills results[0..phenotype_count) for one variant
+	void testVariant(uint32_t variant, const uint64_t* row, double* sums, AssociationResult* results) const
+	{
+		const uint32_t width = panel.cols;
+		const double nan = std::numeric_limits<double>::quiet_NaN();
+
+		accumulateCodeSums(row, reader.subset_words, panel, sums);
+
+		for (const PhenotypeGroup& group : groups)
+		{
+			const uint32_t n = static_cast<uint32_t>(group.covariates.included.size());
+			const uint32_t first = group.column + 1;
+			const uint32_t basis_start = first + static_cast<uint32_t>(group.phenotypes.size());
+
+			for (uint32_t phenotype : group.phenotypes)
+				results[phenotype] = AssociationResult{ variant, n, nan, nan, nan, nan };
+
+			// Genotype counts of the group from its indicator column
+			const double het = sums[group.column];
+			const double hom_alt = sums[width + group.column];
+			const double missing = sums[2 * width + group.column];
+			const double called = n - missing;
+
+			if (called <= 0.0)
+				continue;
+
+			// g.[1 R Q] with dosages 0/1/2 and the mean for missing calls, in place of sums[0..width)
+			const double mean = (het + 2.0 * hom_alt) / called;
+			const double g_norm = het + 4.0 * hom_alt + mean * mean * missing;
+			double projected = 0.0;
+
+			for (uint32_t c = first; c < basis_start + group.covariates.rank; ++c)
+			{
+				sums[c] += 2.0 * sums[width + c] + mean * sums[2 * width + c];
+
+				if (c >= basis_start)
+					projected += sums[c] * sums[c];
+			}
+
+			// Residual sum of squares of g after the covariates
+			const double g_residual = g_norm - projected;
+			const double df = static_cast<double>(n) - group.covariates.rank - 1;
+
+			if (g_residual <= 1e-8 * g_norm || df <= 0)
+				continue;
+
+			for (uint32_t p = 0; p < group.phenotypes.size(); ++p)
+			{
+				const uint32_t phenotype = group.phenotypes[p];
+				AssociationResult& result = results[phenotype];
+				const double g_dot_r = sums[first + p];
+
+				result.beta = g_dot_r / g_residual;
+
+				const double rss = std::max(residual_ss[phenotype] - result.beta * g_dot_r, 0.0);
+
+				result.se = std::sqrt(rss / df / g_residual);
+				result.statistic = result.beta / result.se;
+				result.p = studentTPValue(result.statistic, df);
+			}
+		}
+	}
+
+public:
+	// phenotypes holds one column per trait (sample_count rows); each trait is
+	// tested on the samples that have it and every covariate
+	LinearAssociation(Plink2Reader& reader, const Matrix& phenotypes, const Matrix& covariate_values, const LinearOptions& options)
+		: reader(reader), options(options), phenotype_count(phenotypes.cols), sample_count(0)
+	{
+		if (options.block_variants == 0)
+			throw std::invalid_argument("Association block size must be nonzero");
+
+		if (phenotypes.rows != reader.sample_count || (covariate_values.cols && covariate_values.rows != reader.sample_count))
+			throw std::invalid_argument("Phenotypes and covariates must cover every sample");
+
+		const uint32_t mask_words = (reader.sample_count + 63) / 64;
+		std::vector<uint64_t> union_mask(mask_words, 0);
+		std::map<std::vector<uint64_t>, uint32_t> group_index;
+
+		for (uint32_t phenotype = 0; phenotype < phenotype_count; ++phenotype)
+		{
+			std::vector<uint64_t> mask(mask_words, 0);
+
+			for (uint32_t sample = 0; sample < reader.sample_count; ++sample)
+			{
+				bool usable = !std::isnan(phenotypes(sample, phenotype));
+
+				for (uint32_t c = 0; c < covariate_values.cols && usable; ++c)
+					usable = !std::isnan(covariate_values(sample, c));
+
+				if (usable)
+					mask[sample / 64] |= 1ULL << (sample % 64);
+			}
+
+			auto inserted = group_index.emplace(mask, static_cast<uint32_t>(groups.size()));
+
+			if (inserted.second)
+			{
+				for (uint32_t word = 0; word < mask_words; ++word)
+					union_mask[word] |= mask[word];
+
+				groups.push_back(PhenotypeGroup{ {}, CovariateBasis(mask, covariate_values), 0 });
+			}
+
+			groups[inserted.first->second].phenotypes.push_back(phenotype);
+		}
+
+		// Subset position of every sample in the union
+		std::vector<uint32_t> position(reader.sample_count, 0);
+
+		for (uint32_t sample = 0; sample < reader.sample_count; ++sample)
+		{
+			if (union_mask[sample / 64] >> (sample % 64) & 1)
+				position[sample] = sample_count++;
+		}
+
+		if (!sample_count)
+			throw std::runtime_error("No sample has a phenotype and every covariate");
+
+		uint32_t width = 0;
+
+		for (PhenotypeGroup& group : groups)
+		{
+			group.column = width;
+			width += 1 + static_cast<uint32_t>(group.phenotypes.size()) + group.covariates.rank;
+		}
+
+		panel = Matrix(sample_count, width);
+		residual_ss.assign(phenotype_count, 0.0);
+
+		std::vector<double> residual;
+
+		for (const PhenotypeGroup& group : groups)
+		{
+			const std::vector<uint32_t>& included = group.covariates.included;
+			const uint32_t n = static_cast<uint32_t>(included.size());
+			const uint32_t basis_start = group.column + 1 + static_cast<uint32_t>(group.phenotypes.size());
+
+			residual.resize(n);
+
+			for (uint32_t i = 0; i < n; ++i)
+			{
+				panel(position[included[i]], group.column) = 1.0;
+
+				for (uint32_t c = 0; c < group.covariates.rank; ++c)
+					panel(position[included[i]], basis_start + c) = group.covariates.basis(i, c);
+			}
+
+			for (uint32_t p = 0; p < group.phenotypes.size(); ++p)
+			{
+				const uint32_t phenotype = group.phenotypes[p];
+
+				for (uint32_t i = 0; i < n; ++i)
+					residual[i] = phenotypes(included[i], phenotype);
+
+				group.covariates.residualize(residual);
+
+				for (uint32_t i = 0; i < n; ++i)
+				{
+					panel(position[included[i]], group.column + 1 + p) = residual[i];
+					residual_ss[phenotype] += residual[i] * residual[i];
+				}
+			}
+		}
+
+		reader.setSampleSubset(union_mask);
+	}
+
+	~LinearAssociation()
+	{
+		reader.clearSampleSubset();
+	}
+
+	// Samples with at least one phenotype and every covariate
+	uint32_t sampleCount() const
+	{
+		return sample_count;
+	}
+
+	// Distinct phenotype missingness patterns, each with its own covariate basis
+	uint32_t groupCount() const
+	{
+		return static_cast<uint32_t>(groups.size());
+	}
+
+	// on_variant(results) for every variant in file order, one result per phenotype
+	template <typename VariantFn>
+	void compute(VariantFn on_variant)
+	{
+		const uint32_t width = panel.cols;
+		const uint32_t threads = std::max(1u, options.thread_count);
+
+		std::vector<uint64_t> packed;
+		std::vector<AssociationResult> results;
+		std::vector<double> scratch(static_cast<size_t>(threads) * 3 * width);
+
+		for (uint32_t block_start = 0; block_start < reader.variant_count; block_start += options.block_variants)
+		{
+			const uint32_t block_end = std::min(block_start + options.block_variants, reader.variant_count);
+			const uint32_t block_size = block_end - block_start;
+
+			reader.readPackedSubset(packed, block_start, block_end);
+			results.resize(static_cast<size_t>(block_size) * phenotype_count);
+
+			parallelFor(block_size, threads,
+				[&](uint32_t v, uint32_t thread_index)
+				{
+					testVariant(block_start + v, &packed[static_cast<size_t>(v) * reader.subset_words],
+						&scratch[static_cast<size_t>(thread_index) * 3 * width], &results[static_cast<size_t>(v) * phenotype_count]);
+				});
+
+			for (uint32_t v = 0; v < block_size; ++v)
+				on_variant(&results[static_cast<size_t>(v) * phenotype_count]);
+		}
+	}
+
+	// <prefix>.<phenotype>.glm.linear for every phenotype, written in one pass
+	void write(const std::string& prefix, const std::vector<std::string>& phenotype_names)
+	{
+		if (phenotype_names.size() != phenotype_count)
+			throw std::invalid_argument("One name is needed per phenotype");
+
+		std::vector<std::ofstream> outputs(phenotype_count);
+
+		for (uint32_t phenotype = 0; phenotype < phenotype_count; ++phenotype)
+		{
+			const std::string path = prefix + "." + phenotype_names[phenotype] + ".glm.linear";
+			outputs[phenotype].open(path);
+
+			if (!outputs[phenotype].is_open())
+				throw std::runtime_error("Failed to open " + path);
+
+			outputs[phenotype] << "#CHROM\tPOS\tID\tREF\tALT\tA1\tOBS_CT\tBETA\tSE\tT_STAT\tP\n";
+		}
+
+		std::vector<VariantInfo> variants;
+		reader.readVariantInfo(variants);
+
+		compute([&](const AssociationResult* results)
+			{
+				const VariantInfo& info = variants[results[0].variant];
+
+				for (uint32_t phenotype = 0; phenotype < phenotype_count; ++phenotype)
+				{
+					const AssociationResult& result = results[phenotype];
+					std::ofstream& out = outputs[phenotype];
+
+					out << info.chrom << '\t' << info.pos << '\t' << info.id << '\t' << info.ref << '\t' << info.alt << '\t' << info.alt << '\t' << result.observed;
+
+					if (std::isnan(result.p))
+						out << "\tNA\tNA\tNA\tNA\n";
+					else
+						out << '\t' << result.beta << '\t' << result.se << '\t' << result.statistic << '\t' << result.p << '\n';
+				}
+			});
+
+		for (uint32_t phenotype = 0; phenotype < phenotype_count; ++phenotype)
+		{
+			if (!outputs[phenotype])
+				throw std::runtime_error("Failed to write " + prefix + "." + phenotype_names[phenotype] + ".glm.linear");
+		}
+	}
+};
+
+// Recode a 1 = control / 2 = case phenotype to 0/1; 0 and missing become NaN
+inline void caseControlPhenotype(Matrix& phenotype)
+{
+	for (double& value : phenotype.data)
+	{
+		if (value == 1.0 || value == 2.0)
+			value -= 1.0;
+		else if (value == 0.0 || std::isnan(value))
+			value = std::numeric_limits<double>::quiet_NaN();
+		else
+			throw std::runtime_error("Phenotype is not case/control coded (1 = control, 2 = case)");
+	}
+}
+
+// Maximum likelihood (or Firth-penalized) logistic regression by Newton-Raphson.
+// beta is the starting point and receives the estimate; covariance receives
+// the inverse information. Returns false on non-convergence or separation.
+inline bool fitLogistic(const Matrix& x, const std::vector<double>& y, bool firth, std::vector<double>& beta, Matrix& covariance)
+{
+	const uint32_t n = x.rows;
+	const uint32_t p = x.cols;
+	const uint32_t max_iterations = firth ? 100 : 30;
+
+	std::vector<double> mu(n);
+	std::vector<double> score(p);
+	Matrix information(p, p);
+
+	beta.resize(p, 0.0);
+
+	for (uint32_t iteration = 0; iteration < max_iterations; ++iteration)
+	{
+		std::fill(information.data.begin(), information.data.end(), 0.0);
+
+		for (uint32_t i = 0; i < n; ++i)
+		{
+			const double* xi = x.row(i);
+			double eta = 0.0;
+
+			for (uint32_t c = 0; c < p; ++c)
+				eta += xi[c] * beta[c];
+
+			mu[i] = 1.0 / (1.0 + std::exp(-eta));
+
+			const double weight = mu[i] * (1.0 - mu[i]);
+
+			for (uint32_t a = 0; a < p; ++a)
+			{
+				for (uint32_t b = 0; b <= a; ++b)
+					information(a, b) += weight * xi[a] * xi[b];
+			}
+		}
+
+		for (uint32_t a = 0; a < p; ++a)
+		{
+			for (uint32_t b = a + 1; b < p; ++b)
+				information(a, b) = information(b, a);
+		}
+
+		covariance = information;
+
+		if (!invertPositiveDefinite(covariance))
+			return false;
+
+		std::fill(score.begin(), score.end(), 0.0);
+
+		for (uint32_t i = 0; i < n; ++i)
+		{
+			const double* xi = x.row(i);
+			double residual = y[i] - mu[i];
+
+			// Firth: add h_i (1/2 - mu_i), h the hat matrix diagonal
+			if (firth)
+			{
+				double leverage = 0.0;
+
+				for (uint32_t a = 0; a < p; ++a)
+				{
+					for (uint32_t b = 0; b < p; ++b)
+						leverage += xi[a] * covariance(a, b) * xi[b];
+				}
+
+				residual += leverage * mu[i] * (1.0 - mu[i]) * (0.5 - mu[i]);
+			}
+
+			for (uint32_t c = 0; c < p; ++c)
+				score[c] += xi[c] * residual;
+		}
+
+		// Newton step, capped so separated data cannot run off in one iteration
+		double largest = 0.0;
+		std::vector<double> step(p, 0.0);
+
+		for (uint32_t a = 0; a < p; ++a)
+		{
+			for (uint32_t b = 0; b < p; ++b)
+				step[a] += covariance(a, b) * score[b];
+
+			largest = std::max(largest, std::fabs(step[a]));
+		}
+
+		const double scale = largest > 5.0 ? 5.0 / largest : 1.0;
+
+		for (uint32_t c = 0; c < p; ++c)
+			beta[c] += scale * step[c];
+
+		if (!std::isfinite(largest))
+			return false;
+
+		if (largest < 1e-8)
+			return true;
+	}
+
+	return false;
+}
+
+struct LogisticOptions {
+	uint32_t block_variants = 1024;
+	uint32_t thread_count = 1;
+
+	// Variants with a score-test p below this get a full per-variant fit
+	double refit_p = 0.01;
+
+	// Fit refits with Firth's penalty outright instead of only as the fallback
+	bool always_firth = false;
+};
+
+struct LogisticResult {
+	AssociationResult result;
+	bool refit;
+	bool firth;
+};
+
+// Additive-model logistic regression of a case/control phenotype. The null
+// model (intercept and covariates) is fitted once; every variant then gets a
+// score test, U = g.(y - mu) and V = g'W g - |Q_w^T W^1/2 g|^2 with Q_w an
+// orthonormal basis of W^1/2 [1, covariates]. Like the linear scan this is one
+// per-code product of the block's dosages with a sample panel, so it costs
+// no Newton iterations. Variants whose score p passes refit_p are refitted
+// in full: Newton-Raphson, falling back to Firth on non-convergence.
+class LogisticAssociation {
+private:
+	Plink2Reader& reader;
+	LogisticOptions options;
+	CovariateBasis covariates;
+
+	std::vector<double> outcome;
+
+	// [y - mu, w, W^1/2 Q_w] for the included samples
+	Matrix panel;
+
+	// Null model coefficients on the covariate basis, and one refit design
+	// [g, basis] per thread
+	std::vector<double> null_beta;
+	std::vector<Matrix> designs;
+
+	void refitVariant(LogisticResult& output, const uint64_t* row, double mean, Matrix& design) const
+	{
+		const uint32_t n = design.rows;
+
+		for (uint32_t i = 0; i < n; ++i)
+		{
+			const uint32_t code = getPackedGenotype(row, i);
+			design(i, 0) = code == 3 ? mean : code;
+		}
+
+		std::vector<double> beta(design.cols, 0.0);
+		std::copy(null_beta.begin(), null_beta.end(), beta.begin() + 1);
+
+		Matrix covariance;
+		bool fitted = false;
+
+		if (!options.always_firth)
+			fitted = fitLogistic(design, outcome, false, beta, covariance);
+
+		if (!fitted)
+		{
+			std::fill(beta.begin(), beta.end(), 0.0);
+			std::copy(null_beta.begin(), null_beta.end(), beta.begin() + 1);
+
+			fitted = fitLogistic(design, outcome, true, beta, covariance);
+			output.firth = fitted;
+		}
+
+		// Neither fit converged: the row keeps its score-test result
+		if (!fitted)
+			return;
+
+		AssociationResult& result = output.result;
+		result.beta = beta[0];
+		result.se = std::sqrt(covariance(0, 0));
+		result.statistic = result.beta / result.se;
+		result.p = normalPValue(result.statistic);
+		output.refit = true;
+	}
+
+	LogisticResult testVariant(uint32_t variant, const uint64_t* row, double* sums, Matrix& design) const
+	{
+		const uint32_t width = panel.cols;
+		const uint32_t n = reader.subset_sample_count;
+		const GenotypeCounts counts = countPackedGenotypes(row, reader.subset_words, n);
+		const double nan = std::numeric_limits<double>::quiet_NaN();
+
+		const uint32_t called = counts.hom_ref + counts.het + counts.hom_alt;
+
+		LogisticResult output = { { variant, n, nan, nan, nan, nan }, false, false };
+		AssociationResult& result = output.result;
+
+		if (!called)
+			return output;
+
+		accumulateCodeSums(row, reader.subset_words, panel, sums);
+
+		const double mean = (counts.het + 2.0 * counts.hom_alt) / called;
+		double dots[2] = { 0.0, 0.0 };
+		double projected = 0.0;
+
+		for (uint32_t c = 0; c < width; ++c)
+		{
+			// Column 1 holds w, so its "dot" with g^2 weights the squared codes
+			const double dot = c == 1
+				? sums[c] + 4.0 * sums[width + c] + mean * mean * sums[2 * width + c]
+				: sums[c] + 2.0 * sums[width + c] + mean * sums[2 * width + c];
+
+			if (c < 2)
+				dots[c] = dot;
+			else
+				projected += dot * dot;
+		}
+
+		const double u = dots[0];
+		const double v = dots[1] - projected;
+
+		if (v <= 1e-8 * dots[1])
+			return output;
+
+		// One-step estimate from the score test
+		result.beta = u / v;
+		result.se = 1.0 / std::sqrt(v);
+		result.statistic = u / std::sqrt(v);
+		result.p = normalPValue(result.statistic);
+
+		if (result.p < options.refit_p)
+			refitVariant(output, row, mean, design);
+
+		return output;
+	}
+
+public:
+	uint32_t refit_count;
+	uint32_t firth_count;
+
+	// phenotype is a single 0/1 column (see caseControlPhenotype)
+	LogisticAssociation(Plink2Reader& reader, const Matrix& phenotype, const Matrix& covariate_values, const LogisticOptions& options)
+		: reader(reader), options(options), covariates(reader, phenotype, covariate_values), refit_count(0), firth_count(0)
+	{
+		if (options.block_variants == 0)
+			throw std::invalid_argument("Association block size must be nonzero");
+
+		if (phenotype.cols != 1)
+			throw std::invalid_argument("Logistic regression takes a single phenotype");
+
+		const uint32_t n = static_cast<uint32_t>(covariates.included.size());
+		const uint32_t rank = covariates.rank;
+
+		if (n <= rank + 1)
+			throw std::runtime_error("Too few samples with phenotype and covariates");
+
+		outcome.resize(n);
+
+		for (uint32_t i = 0; i < n; ++i)
+			outcome[i] = phenotype(covariates.included[i], 0);
+
+		// Null model on the covariate basis (same fitted values as on [1, covariates])
+		Matrix covariance;
+
+		if (!fitLogistic(covariates.basis, outcome, false, null_beta, covariance))
+			throw std::runtime_error("Null logistic model did not converge (all cases or all controls?)");
+
+		Matrix weighted(n, rank);
+		std::vector<double> weight(n);
+		panel = Matrix(n, rank + 2);
+
+		for (uint32_t i = 0; i < n; ++i)
+		{
+			double eta = 0.0;
+
+			for (uint32_t c = 0; c < rank; ++c)
+				eta += covariates.basis(i, c) * null_beta[c];
+
+			const double mu = 1.0 / (1.0 + std::exp(-eta));
+			weight[i] = mu * (1.0 - mu);
+
+			panel(i, 0) = outcome[i] - mu;
+			panel(i, 1) = weight[i];
+
+			for (uint32_t c = 0; c < rank; ++c)
+				weighted(i, c) = std::sqrt(weight[i]) * covariates.basis(i, c);
+		}
+
+		orthonormalizeColumns(weighted);
+
+		for (uint32_t i = 0; i < n; ++i)
+		{
+			for (uint32_t c = 0; c < rank; ++c)
+				panel(i, c + 2) = std::sqrt(weight[i]) * weighted(i, c);
+		}
+
+		// One refit design per thread; column 0 is overwritten with each variant's dosages
+		designs.resize(std::max(1u, options.thread_count));
+
+		for (Matrix& design : designs)
+		{
+			design = Matrix(n, rank + 1);
+
+			for (uint32_t i = 0; i < n; ++i)
+			{
+				for (uint32_t c = 0; c < rank; ++c)
+					design(i, c + 1) = covariates.basis(i, c);
+			}
+		}
+	}
+
+	~LogisticAssociation()
+	{
+		reader.clearSampleSubset();
+	}
+
+	uint32_t sampleCount() const
+	{
+		return static_cast<uint32_t>(covariates.included.size());
+	}
+
+	// on_result(result) for every variant in file order
+	template <typename ResultFn>
+	void compute(ResultFn on_result)
+	{
+		const uint32_t width = panel.cols;
+		const uint32_t threads = static_cast<uint32_t>(designs.size());
+
+		std::vector<uint64_t> packed;
+		std::vector<LogisticResult> results;
+		std::vector<double> scratch(static_cast<size_t>(threads) * 3 * width);
+
+		refit_count = 0;
+		firth_count = 0;
+
+		for (uint32_t block_start = 0; block_start < reader.variant_count; block_start += options.block_variants)
+		{
+			const uint32_t block_end = std::min(block_start + options.block_variants, reader.variant_count);
+			const uint32_t block_size = block_end - block_start;
+
+			reader.readPackedSubset(packed, block_start, block_end);
+			results.resize(block_size);
+
+			parallelFor(block_size, threads,
+				[&](uint32_t v, uint32_t thread_index)
+				{
+					results[v] = testVariant(block_start + v, &packed[static_cast<size_t>(v) * reader.subset_words], &scratch[static_cast<size_t>(thread_index) * 3 * width], designs[thread_index]);
+				});
+
+			for (const LogisticResult& result : results)
+			{
+				refit_count += result.refit;
+				firth_count += result.firth;
+				on_result(result);
+			}
+		}
+	}
+
+	// <prefix>.<phenotype>.glm.logistic; TEST is SCORE for score-test rows
+	// (one-step BETA/SE) and WALD for refitted ones
+	void write(const std::string& prefix, const std::string& phenotype_name)
+	{
+		const std::string path = prefix + "." + phenotype_name + ".glm.logistic";
+		std::ofstream out(path);
+
+		if (!out.is_open())
+			throw std::runtime_error("Failed to open " + path);
+
+		std::vector<VariantInfo> variants;
+		reader.readVariantInfo(variants);
+
+		out << "#CHROM\tPOS\tID\tREF\tALT\tA1\tFIRTH?\tTEST\tOBS_CT\tBETA\tSE\tZ_STAT\tP\n";
+
+		compute([&](const LogisticResult& output)
+			{
+				const AssociationResult& result = output.result;
+				const VariantInfo& info = variants[result.variant];
+
+				out << info.chrom << '\t' << info.pos << '\t' << info.id << '\t' << info.ref << '\t' << info.alt << '\t' << info.alt << '\t'
+					<< (output.firth ? 'Y' : 'N') << '\t' << (output.refit ? "WALD" : "SCORE") << '\t' << result.observed;
+
+				if (std::isnan(result.p))
+					out << "\tNA\tNA\tNA\tNA\n";
+				else
+					out << '\t' << result.beta << '\t' << result.se << '\t' << result.statistic << '\t' << result.p << '\n';
+			});
+
+		if (!out)
+			throw std::runtime_error("Failed to write " + path);
+	}
+};
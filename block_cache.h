@@ -0,0 +1,149 @@
+#pragma once
+
+#include <vector>
+#include <list>
+#include <unordered_map>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <cstdint>
+#include <stdexcept>
+
+// Decoded packed rows of one cache block (block_variants consecutive variants,
+// fewer for the final block)
+typedef std::shared_ptr<const std::vector<uint64_t>> DecodedBlock;
+
+struct BlockCacheStats {
+	uint64_t hits;
+	uint64_t misses;
+	uint64_t evictions;
+	uint64_t bytes_used;
+	uint64_t byte_budget;
+};
+
+// Sharded LRU cache of decoded variant blocks. Blocks are spread over shards by
+// block index and each shard has its own lock and its own slice of the byte
+// budget, so concurrent readers only contend when they touch the same shard.
+class DecodedBlockCache {
+private:
+	struct Shard {
+		std::mutex mutex;
+		// Most recently used at the front
+		std::list<std::pair<uint32_t, DecodedBlock>> lru;
+		std::unordered_map<uint32_t, std::list<std::pair<uint32_t, DecodedBlock>>::iterator> index;
+		uint64_t bytes_used = 0;
+	};
+
+	std::vector<Shard> shards;
+	uint64_t shard_budget;
+
+	std::atomic<uint64_t> hits;
+	std::atomic<uint64_t> misses;
+	std::atomic<uint64_t> evictions;
+
+	static uint64_t blockBytes(const DecodedBlock& block)
+	{
+		return block->size() * sizeof(uint64_t);
+	}
+
+	Shard& shardFor(uint32_t block_index)
+	{
+		return shards[block_index % shards.size()];
+	}
+
+public:
+	const uint64_t byte_budget;
+	const uint32_t block_variants;
+
+	DecodedBlockCache(uint64_t byte_budget, uint32_t block_variants, uint32_t shard_count)
+		: shards(shard_count),
+		shard_budget(shard_count ? byte_budget / shard_count : 0),
+		hits(0),
+		misses(0),
+		evictions(0),
+		byte_budget(byte_budget),
+		block_variants(block_variants)
+	{
+		if (block_variants == 0 || shard_count == 0)
+			throw std::invalid_argument("Block cache needs nonzero block size and shard count");
+	}
+
+	DecodedBlock find(uint32_t block_index)
+	{
+		Shard& shard = shardFor(block_index);
+		std::lock_guard<std::mutex> lock(shard.mutex);
+
+		auto it = shard.index.find(block_index);
+
+		if (it == shard.index.end())
+		{
+			misses++;
+			return DecodedBlock();
+		}
+
+		shard.lru.splice(shard.lru.begin(), shard.lru, it->second);
+		hits++;
+		return it->second->second;
+	}
+
+	void insert(uint32_t block_index, const DecodedBlock& block)
+	{
+		const uint64_t bytes = blockBytes(block);
+
+		// Blocks larger than a shard's budget are never cached
+		if (bytes > shard_budget)
+			return;
+
+		Shard& shard = shardFor(block_index);
+		std::lock_guard<std::mutex> lock(shard.mutex);
+
+		auto it = shard.index.find(block_index);
+
+		if (it != shard.index.end())
+		{
+			shard.lru.splice(shard.lru.begin(), shard.lru, it->second);
+			return;
+		}
+
+		while (shard.bytes_used + bytes > shard_budget && !shard.lru.empty())
+		{
+			shard.bytes_used -= blockBytes(shard.lru.back().second);
+			shard.index.erase(shard.lru.back().first);
+			shard.lru.pop_back();
+			evictions++;
+		}
+
+		shard.lru.emplace_front(block_index, block);
+		shard.index[block_index] = shard.lru.begin();
+		shard.bytes_used += bytes;
+	}
+
+	void clear()
+	{
+		for (Shard& shard : shards)
+		{
+			std::lock_guard<std::mutex> lock(shard.mutex);
+			shard.lru.clear();
+			shard.index.clear();
+			shard.bytes_used = 0;
+		}
+	}
+
+	BlockCacheStats stats()
+	{
+		BlockCacheStats result;
+		result.hits = hits;
+		result.misses = misses;
+		result.evictions = evictions;
+		result.bytes_used = 0;
+		result.byte_budget = byte_budget;
+
+		for (Shard& shard : shards)
+		{
+			std::lock_guard<std::mutex> lock(shard.mutex);
+			result.bytes_used += shard.bytes_used;
+		}
+
+		return result;
+	}
+};
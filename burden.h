@@ -0,0 +1,472 @@
+#pragma once
+
+#include <fstream>
+#include <sstream>
+#include <vector>
+#include <string>
+#include <map>
+#include <stdexcept>
+#include <cstdint>
+#include <cmath>
+#include <limits>
+#include <utility>
+#include <algorithm>
+
+#include "plink2_reader.h"
+#include "parallel.h"
+#include "linear_algebra.h"
+#include "statistics.h"
+#include "ld.h"
+
+// A named variant set as sorted, non-overlapping [begin, end) variant ranges
+struct BurdenRegion {
+	std::string name;
+	std::vector<std::pair<uint32_t, uint32_t>> ranges;
+};
+
+// Region sets from a whitespace-delimited file of CHROM START END NAME lines
+// (1-based, inclusive positions; '#' lines skipped). Lines sharing a NAME form
+// one set, e.g. the exons of a gene. Each line is resolved by binary search
+// over its chromosome's .pvar positions, which must be sorted. Sets keep the
+// order of their first line; sets matching no variant are kept, empty.
+inline void readBurdenRegions(const std::string& path, const std::vector<VariantInfo>& variants, std::vector<BurdenRegion>& regions)
+{
+	std::ifstream file(path);
+
+	if (!file.is_open())
+		throw std::runtime_error("Failed to open " + path);
+
+	std::map<std::string, std::pair<uint32_t, uint32_t>> chromosomes;
+
+	for (const auto& range : chromosomeRanges(variants))
+	{
+		const std::string& chrom = variants[range.first].chrom;
+
+		if (!chromosomes.emplace(chrom, range).second)
+			throw std::runtime_error("Chromosome " + chrom + " is not contiguous in the .pvar");
+
+		for (uint32_t variant = range.first + 1; variant < range.second; ++variant)
+		{
+			if (variants[variant].pos < variants[variant - 1].pos)
+				throw std::runtime_error("Positions on chromosome " + chrom + " are not sorted in the .pvar");
+		}
+	}
+
+	std::map<std::string, uint32_t> region_index;
+	std::string line;
+
+	regions.clear();
+
+	while (std::getline(file, line))
+	{
+		std::istringstream stream(line);
+		std::string chrom, name;
+		uint32_t start, end;
+
+		if (line.empty() || line[0] == '#' || !(stream >> chrom))
+			continue;
+
+		if (!(stream >> start >> end >> name) || start > end)
+			throw std::runtime_error("Invalid region line in " + path + ": " + line);
+
+		auto inserted = region_index.emplace(name, static_cast<uint32_t>(regions.size()));
+
+		if (inserted.second)
+			regions.push_back({ name, {} });
+
+		auto chrom_it = chromosomes.find(chrom);
+
+		if (chrom_it == chromosomes.end())
+			continue;
+
+		// First variant of the chromosome at or past pos
+		auto firstAtOrAfter = [&](uint64_t pos)
+		{
+			uint32_t low = chrom_it->second.first, high = chrom_it->second.second;
+
+			while (low < high)
+			{
+				const uint32_t middle = low + (high - low) / 2;
+
+				if (variants[middle].pos < pos)
+					low = middle + 1;
+				else
+					high = middle;
+			}
+
+			return low;
+		};
+
+		const uint32_t first = firstAtOrAfter(start);
+		const uint32_t last = firstAtOrAfter(static_cast<uint64_t>(end) + 1);
+
+		if (first < last)
+			regions[inserted.first->second].ranges.emplace_back(first, last);
+	}
+
+	// Overlapping lines of a set must not count a variant twice
+	for (BurdenRegion& region : regions)
+	{
+		std::vector<std::pair<uint32_t, uint32_t>> merged;
+
+		std::sort(region.ranges.begin(), region.ranges.end());
+
+		for (const auto& range : region.ranges)
+		{
+			if (!merged.empty() && range.first <= merged.back().second)
+				merged.back().second = std::max(merged.back().second, range.second);
+			else
+				merged.push_back(range);
+		}
+
+		region.ranges.swap(merged);
+	}
+}
+
+struct BurdenOptions {
+	// Variants with a minor allele frequency above this are left out of every set
+	double max_maf = 0.01;
+
+	// Weight variants by the Beta(1, 25) density of their MAF (as SKAT does)
+	// rather than equally
+	bool beta_weights = true;
+
+	uint32_t thread_count = 1;
+};
+
+struct BurdenResult {
+	uint32_t variants_used;
+	uint64_t minor_allele_count;
+	double burden_chisq;
+	double burden_p;
+	double skat_q;
+	double skat_p;
+};
+
+// Burden and SKAT tests of a phenotype over region sets of rare variants,
+// both score tests of the intercept-only linear model. Every set is read
+// through readSparseVariants, so a rare variant is its list of samples off the
+// common genotype and is never expanded to a dense row. With x the centered
+// (mean-imputed) dosages and r the centered phenotype, each variant's score is
+// r.x over its listed samples alone. The weighted burden score of each sample
+// is built by scatter-adding those lists, and the SKAT kernel x_j.x_k by
+// scattering one variant and gathering over another. The SKAT p-value matches
+// the mean, variance and kurtosis of the null mixture of chi-squares (modified
+// Liu method).
+class RegionBurdenTest {
+private:
+	Plink2Reader& reader;
+	BurdenOptions options;
+	std::vector<BurdenRegion> regions;
+
+	// Residual of each sample's phenotype, 0 and not included when missing
+	std::vector<double> residuals;
+	std::vector<uint8_t> included;
+	uint32_t included_count;
+	double variance;
+
+	// A variant over the included samples: the centered dosage a of the
+	// common genotype and, per listed sample, its dosage less the common one
+	struct CenteredVariant {
+		double common_value;
+		double weight;
+		std::vector<uint32_t> samples;
+		std::vector<double> deltas;
+	};
+
+	// Centers one sparse variant; false if it is not rare or not polymorphic
+	bool centerVariant(const SparseVariant& sparse, CenteredVariant& out, uint64_t& minor_alleles) const
+	{
+		uint32_t listed[4] = { 0, 0, 0, 0 };
+
+		out.samples.clear();
+		out.deltas.clear();
+
+		for (uint32_t entry = 0; entry < sparse.samples.size(); ++entry)
+		{
+			if (!included[sparse.samples[entry]])
+				continue;
+
+			listed[sparse.genotypes[entry]]++;
+			out.samples.push_back(sparse.samples[entry]);
+			out.deltas.push_back(sparse.genotypes[entry]);
+		}
+
+		uint32_t counts[4] = { listed[0], listed[1], listed[2], listed[3] };
+		counts[sparse.common] += included_count - static_cast<uint32_t>(out.samples.size());
+
+		const uint32_t called = included_count - counts[3];
+
+		if (!called)
+			return false;
+
+		const uint64_t alt_alleles = counts[1] + 2ULL * counts[2];
+		const double mean = static_cast<double>(alt_alleles) / called;
+		const double maf = std::min(mean, 2.0 - mean) / 2.0;
+
+		if (maf == 0.0 || maf > options.max_maf)
+			return false;
+
+		minor_alleles = std::min<uint64_t>(alt_alleles, 2ULL * called - alt_alleles);
+
+		// Missing calls take the mean dosage
+		out.common_value = sparse.common == 3 ? 0.0 : sparse.common - mean;
+		out.weight = options.beta_weights ? 25.0 * std::pow(1.0 - maf, 24.0) : 1.0;
+
+		for (uint32_t entry = 0; entry < out.samples.size(); ++entry)
+		{
+			const double value = out.deltas[entry] == 3.0 ? 0.0 : out.deltas[entry] - mean;
+			out.deltas[entry] = value - out.common_value;
+		}
+
+		return true;
+	}
+
+	BurdenResult testRegion(const BurdenRegion& region, std::vector<SparseVariant>& sparse, std::vector<double>& scratch, std::vector<uint32_t>& touched) const
+	{
+		const uint32_t n = included_count;
+		std::vector<CenteredVariant> set;
+		BurdenResult result = { 0, 0, std::numeric_limits<double>::quiet_NaN(), std::numeric_limits<double>::quiet_NaN(),
+			std::numeric_limits<double>::quiet_NaN(), std::numeric_limits<double>::quiet_NaN() };
+
+		for (const auto& range : region.ranges)
+		{
+			reader.readSparseVariants(sparse, range.first, range.second);
+
+			for (const SparseVariant& variant : sparse)
+			{
+				CenteredVariant centered;
+				uint64_t minor_alleles;
+
+				if (!centerVariant(variant, centered, minor_alleles))
+					continue;
+
+				result.minor_allele_count += minor_alleles;
+				set.push_back(std::move(centered));
+			}
+		}
+
+		const uint32_t m = static_cast<uint32_t>(set.size());
+		result.variants_used = m;
+
+		if (!m)
+			return result;
+
+		// Scores: the common value meets sum(r) = 0, leaving the listed samples
+		std::vector<double> scores(m, 0.0), sums(m, 0.0);
+
+		for (uint32_t j = 0; j < m; ++j)
+		{
+			for (uint32_t entry = 0; entry < set[j].samples.size(); ++entry)
+			{
+				scores[j] += residuals[set[j].samples[entry]] * set[j].deltas[entry];
+				sums[j] += set[j].deltas[entry];
+			}
+		}
+
+		// Burden of sample s: sum_j w_j (a_j + delta_sj), scatter-added over the
+		// listed samples on top of the shared offset sum_j w_j a_j
+		double offset = 0.0, weighted_score = 0.0;
+
+		for (uint32_t j = 0; j < m; ++j)
+		{
+			offset += set[j].weight * set[j].common_value;
+			weighted_score += set[j].weight * scores[j];
+
+			for (uint32_t entry = 0; entry < set[j].samples.size(); ++entry)
+			{
+				const uint32_t sample = set[j].samples[entry];
+
+				if (scratch[sample] == 0.0)
+					touched.push_back(sample);
+
+				scratch[sample] += set[j].weight * set[j].deltas[entry];
+			}
+		}
+
+		// sum_s (offset + D_s)^2 with D zero off the touched samples
+		double burden_squares = n * offset * offset;
+
+		for (uint32_t sample : touched)
+		{
+			burden_squares += scratch[sample] * (2.0 * offset + scratch[sample]);
+			scratch[sample] = 0.0;
+		}
+
+		touched.clear();
+
+		if (burden_squares > 0.0)
+		{
+			result.burden_chisq = weighted_score * weighted_score / (variance * burden_squares);
+			result.burden_p = chiSquarePValue(result.burden_chisq, 1.0);
+		}
+
+		// Kernel x_j.x_k = n a_j a_k + a_j sum(delta_k) + a_k sum(delta_j) + delta_j.delta_k,
+		// the last by scattering variant j and gathering over variant k
+		Matrix kernel(m, m);
+
+		for (uint32_t j = 0; j < m; ++j)
+		{
+			for (uint32_t entry = 0; entry < set[j].samples.size(); ++entry)
+				scratch[set[j].samples[entry]] = set[j].deltas[entry];
+
+			for (uint32_t k = 0; k <= j; ++k)
+			{
+				double product = static_cast<double>(n) * set[j].common_value * set[k].common_value
+					+ set[j].common_value * sums[k] + set[k].common_value * sums[j];
+
+				for (uint32_t entry = 0; entry < set[k].samples.size(); ++entry)
+					product += scratch[set[k].samples[entry]] * set[k].deltas[entry];
+
+				kernel(j, k) = kernel(k, j) = variance * set[j].weight * set[k].weight * product;
+			}
+
+			for (uint32_t sample : set[j].samples)
+				scratch[sample] = 0.0;
+		}
+
+		double q = 0.0;
+
+		for (uint32_t j = 0; j < m; ++j)
+			q += set[j].weight * set[j].weight * scores[j] * scores[j];
+
+		std::vector<double> eigenvalues;
+		Matrix eigenvectors;
+		symmetricEigen(kernel, eigenvalues, eigenvectors);
+
+		double c[4] = { 0.0, 0.0, 0.0, 0.0 };
+
+		for (double lambda : eigenvalues)
+		{
+			if (lambda <= 0.0)
+				continue;
+
+			double power = lambda;
+
+			for (uint32_t moment = 0; moment < 4; ++moment, power *= lambda)
+				c[moment] += power;
+		}
+
+		result.skat_q = q;
+
+		if (c[1] > 0.0)
+		{
+			// Q ~ sum lambda chi2_1 matched to chi2_l on its mean, variance and kurtosis
+			const double l = c[1] * c[1] / c[3];
+			const double standardized = (q - c[0]) / std::sqrt(2.0 * c[1]);
+
+			result.skat_p = chiSquarePValue(standardized * std::sqrt(2.0 * l) + l, l);
+		}
+
+		return result;
+	}
+
+public:
+	std::vector<BurdenResult> results;
+
+	RegionBurdenTest(Plink2Reader& reader, const Matrix& phenotype, const std::vector<BurdenRegion>& regions, const BurdenOptions& options)
+		: reader(reader), options(options), regions(regions), residuals(reader.sample_count, 0.0), included(reader.sample_count, 0),
+		  included_count(0), variance(0.0)
+	{
+		if (!(options.max_maf > 0.0 && options.max_maf <= 0.5))
+			throw std::invalid_argument("Burden MAF limit must be in (0, 0.5]");
+
+		if (phenotype.rows != reader.sample_count)
+			throw std::invalid_argument("Phenotype does not match the sample count");
+
+		double sum = 0.0;
+
+		for (uint32_t sample = 0; sample < phenotype.rows; ++sample)
+		{
+			if (std::isnan(phenotype(sample, 0)))
+				continue;
+
+			included[sample] = 1;
+			included_count++;
+			sum += phenotype(sample, 0);
+		}
+
+		if (included_count < 2)
+			throw std::runtime_error("Burden test needs at least two samples with a phenotype");
+
+		const double mean = sum / included_count;
+		double squares = 0.0;
+
+		for (uint32_t sample = 0; sample < phenotype.rows; ++sample)
+		{
+			if (!included[sample])
+				continue;
+
+			residuals[sample] = phenotype(sample, 0) - mean;
+			squares += residuals[sample] * residuals[sample];
+		}
+
+		variance = squares / (included_count - 1);
+
+		if (!(variance > 0.0))
+			throw std::runtime_error("Phenotype has no variance");
+	}
+
+	uint32_t sampleCount() const
+	{
+		return included_count;
+	}
+
+	void compute()
+	{
+		const uint32_t threads = std::max(1u, options.thread_count);
+
+		std::vector<std::vector<SparseVariant>> sparse(threads);
+		std::vector<std::vector<double>> scratch(threads, std::vector<double>(reader.sample_count, 0.0));
+		std::vector<std::vector<uint32_t>> touched(threads);
+
+		results.resize(regions.size());
+
+		parallelFor(static_cast<uint32_t>(regions.size()), threads,
+			[&](uint32_t region, uint32_t thread_index)
+			{
+				results[region] = testRegion(regions[region], sparse[thread_index], scratch[thread_index], touched[thread_index]);
+			});
+	}
+
+	// <prefix>.<name>.burden: per set the rare variants used, their minor
+	// allele count, the burden chi-square and p, and SKAT's Q and p
+	void write(const std::string& prefix, const std::string& name)
+	{
+		compute();
+
+		const std::string path = prefix + "." + name + ".burden";
+		std::ofstream out(path);
+
+		if (!out.is_open())
+			throw std::runtime_error("Failed to open " + path);
+
+		auto number = [&](double value)
+		{
+			if (std::isfinite(value))
+				out << value;
+			else
+				out << "NA";
+		};
+
+		out << "#SET\tNVAR\tMAC\tBURDEN_CHISQ\tBURDEN_P\tSKAT_Q\tSKAT_P\n";
+
+		for (uint32_t region = 0; region < regions.size(); ++region)
+		{
+			const BurdenResult& result = results[region];
+
+			out << regions[region].name << '\t' << result.variants_used << '\t' << result.minor_allele_count << '\t';
+			number(result.burden_chisq);
+			out << '\t';
+			number(result.burden_p);
+			out << '\t';
+			number(result.skat_q);
+			out << '\t';
+			number(result.skat_p);
+			out << '\n';
+		}
+
+		if (!out)
+			throw std::runtime_error("Failed to write " + path);
+	}
+};
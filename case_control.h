@@ -0,0 +1,283 @@
+#pragma once
+
+#include <fstream>
+#include <vector>
+#include <string>
+#include <stdexcept>
+#include <cstdint>
+#include <cmath>
+#include <limits>
+#include <algorithm>
+
+#include "plink2_reader.h"
+#include "parallel.h"
+#include "linear_algebra.h"
+
+// Case and control samples of a 0/1 phenotype (NaN = missing) as field masks
+// over packed rows: bit 0 of a sample's 2-bit field is set
+struct CaseControlMasks {
+	std::vector<uint64_t> cases;
+	std::vector<uint64_t> controls;
+	uint32_t case_count = 0;
+	uint32_t control_count = 0;
+
+	CaseControlMasks(const Matrix& phenotype, uint32_t words)
+		: cases(words, 0), controls(words, 0)
+	{
+		for (uint32_t sample = 0; sample < phenotype.rows; ++sample)
+		{
+			const double value = phenotype(sample, 0);
+			const uint64_t field = 1ULL << (2 * (sample % kGenotypesPerWord));
+
+			if (value == 1.0)
+			{
+				cases[sample / kGenotypesPerWord] |= field;
+				case_count++;
+			}
+			else if (value == 0.0)
+			{
+				controls[sample / kGenotypesPerWord] |= field;
+				control_count++;
+			}
+		}
+
+		if (!case_count || !control_count)
+			throw std::runtime_error("Case/control test needs both cases and controls");
+	}
+};
+
+// Het, hom alt and missing counts of one packed row over the samples of a field mask
+inline void countStratum(const uint64_t* row, const uint64_t* mask, uint32_t words, uint32_t& het, uint32_t& hom_alt, uint32_t& missing)
+{
+	het = hom_alt = missing = 0;
+
+	for (uint32_t word = 0; word < words; ++word)
+	{
+		const uint64_t low = row[word] & mask[word];
+		const uint64_t high = (row[word] >> 1) & mask[word];
+
+		het += popcount64(low & ~high);
+		hom_alt += popcount64(high & ~low);
+		missing += popcount64(low & high);
+	}
+}
+
+// Pearson chi-square of a 2 x columns table given by its rows; columns with no
+// observations are dropped from the table and the degrees of freedom. NaN
+// when fewer than two columns or either row is empty.
+inline double tableChiSquare(const double* top, const double* bottom, uint32_t columns, uint32_t& degrees_of_freedom)
+{
+	double top_total = 0.0, bottom_total = 0.0;
+	uint32_t used = 0;
+
+	for (uint32_t column = 0; column < columns; ++column)
+	{
+		top_total += top[column];
+		bottom_total += bottom[column];
+		used += top[column] + bottom[column] > 0.0;
+	}
+
+	degrees_of_freedom = used ? used - 1 : 0;
+
+	if (used < 2 || top_total == 0.0 || bottom_total == 0.0)
+		return std::numeric_limits<double>::quiet_NaN();
+
+	const double total = top_total + bottom_total;
+	double statistic = 0.0;
+
+	for (uint32_t column = 0; column < columns; ++column)
+	{
+		const double column_total = top[column] + bottom[column];
+
+		if (column_total == 0.0)
+			continue;
+
+		const double expected_top = top_total * column_total / total;
+		const double expected_bottom = bottom_total * column_total / total;
+
+		statistic += (top[column] - expected_top) * (top[column] - expected_top) / expected_top
+			+ (bottom[column] - expected_bottom) * (bottom[column] - expected_bottom) / expected_bottom;
+	}
+
+	return statistic;
+}
+
+// Chi-square upper tail in closed form for the one and two degree of freedom
+// tables used here
+inline double smallDfChiSquarePValue(double statistic, uint32_t degrees_of_freedom)
+{
+	if (std::isnan(statistic))
+		return std::numeric_limits<double>::quiet_NaN();
+
+	return degrees_of_freedom == 1 ? std::erfc(std::sqrt(statistic / 2.0)) : std::exp(-statistic / 2.0);
+}
+
+struct CaseControlOptions {
+	uint32_t block_variants = 4096;
+	uint32_t thread_count = 1;
+};
+
+// Stratified genotype counts per variant with the allelic (2 x 2, 1 df) and
+// genotypic (2 x 3, 2 df) chi-square tests. The case and control masks are
+// built once; each variant's counts are three masked popcounts per stratum
+// and word. Counts of a block are gathered first, then the tests run over
+// the block's count arrays in one loop.
+class CaseControlAssociation {
+private:
+	Plink2Reader& reader;
+	CaseControlOptions options;
+	CaseControlMasks masks;
+
+public:
+	// Per variant: hom ref, het and hom alt counts of cases and of controls
+	std::vector<uint32_t> case_counts;
+	std::vector<uint32_t> control_counts;
+
+	std::vector<double> allelic_chisq;
+	std::vector<double> allelic_p;
+	std::vector<double> odds_ratio;
+	std::vector<double> genotypic_chisq;
+	std::vector<double> genotypic_p;
+
+	CaseControlAssociation(Plink2Reader& reader, const Matrix& phenotype, const CaseControlOptions& options)
+		: reader(reader), options(options), masks(phenotype, reader.packed_words)
+	{
+		if (options.block_variants == 0)
+			throw std::invalid_argument("Case/control block size must be nonzero");
+
+		if (phenotype.rows != reader.sample_count)
+			throw std::invalid_argument("Phenotype does not match the sample count");
+	}
+
+	uint32_t caseCount() const
+	{
+		return masks.case_count;
+	}
+
+	uint32_t controlCount() const
+	{
+		return masks.control_count;
+	}
+
+	void compute()
+	{
+		const uint32_t variant_count = reader.variant_count;
+		const uint32_t words = reader.packed_words;
+		const uint32_t task_variants = 256;
+
+		case_counts.assign(3 * static_cast<size_t>(variant_count), 0);
+		control_counts.assign(3 * static_cast<size_t>(variant_count), 0);
+		allelic_chisq.resize(variant_count);
+		allelic_p.resize(variant_count);
+		odds_ratio.resize(variant_count);
+		genotypic_chisq.resize(variant_count);
+		genotypic_p.resize(variant_count);
+
+		std::vector<uint64_t> packed;
+
+		for (uint32_t start = 0; start < variant_count; start += options.block_variants)
+		{
+			const uint32_t end = std::min(start + options.block_variants, variant_count);
+
+			reader.readPackedVariants(packed, start, end);
+
+			parallelFor((end - start + task_variants - 1) / task_variants, options.thread_count,
+				[&](uint32_t task, uint32_t)
+				{
+					const uint32_t task_start = start + task * task_variants;
+					const uint32_t task_end = std::min(task_start + task_variants, end);
+
+					for (uint32_t variant = task_start; variant < task_end; ++variant)
+					{
+						const uint64_t* row = &packed[static_cast<size_t>(variant - start) * words];
+						uint32_t* cases = &case_counts[3 * static_cast<size_t>(variant)];
+						uint32_t* controls = &control_counts[3 * static_cast<size_t>(variant)];
+						uint32_t missing;
+
+						countStratum(row, masks.cases.data(), words, cases[1], cases[2], missing);
+						cases[0] = masks.case_count - cases[1] - cases[2] - missing;
+
+						countStratum(row, masks.controls.data(), words, controls[1], controls[2], missing);
+						controls[0] = masks.control_count - controls[1] - controls[2] - missing;
+					}
+				});
+
+			for (uint32_t variant = start; variant < end; ++variant)
+			{
+				const uint32_t* cases = &case_counts[3 * static_cast<size_t>(variant)];
+				const uint32_t* controls = &control_counts[3 * static_cast<size_t>(variant)];
+
+				// Allele table: ALT and REF copies
+				const double case_alleles[2] = { cases[1] + 2.0 * cases[2], cases[1] + 2.0 * cases[0] };
+				const double control_alleles[2] = { controls[1] + 2.0 * controls[2], controls[1] + 2.0 * controls[0] };
+				const double case_genotypes[3] = { static_cast<double>(cases[0]), static_cast<double>(cases[1]), static_cast<double>(cases[2]) };
+				const double control_genotypes[3] = { static_cast<double>(controls[0]), static_cast<double>(controls[1]), static_cast<double>(controls[2]) };
+				uint32_t df;
+
+				allelic_chisq[variant] = tableChiSquare(case_alleles, control_alleles, 2, df);
+				allelic_p[variant] = smallDfChiSquarePValue(allelic_chisq[variant], df);
+				odds_ratio[variant] = case_alleles[0] * control_alleles[1] / (case_alleles[1] * control_alleles[0]);
+
+				genotypic_chisq[variant] = tableChiSquare(case_genotypes, control_genotypes, 3, df);
+				genotypic_p[variant] = smallDfChiSquarePValue(genotypic_chisq[variant], df);
+			}
+		}
+	}
+
+	// <prefix>.<name>.assoc: case and control genotype counts (hom alt/het/hom
+	// ref), ALT frequencies, allelic chi-square, p and odds ratio, then the
+	// genotypic chi-square and p
+	void write(const std::string& prefix, const std::string& name)
+	{
+		compute();
+
+		std::vector<VariantInfo> variants;
+		reader.readVariantInfo(variants);
+
+		const std::string path = prefix + "." + name + ".assoc";
+		std::ofstream out(path);
+
+		if (!out.is_open())
+			throw std::runtime_error("Failed to open " + path);
+
+		auto number = [&](double value)
+		{
+			if (std::isfinite(value))
+				out << value;
+			else
+				out << "NA";
+		};
+
+		out << "#CHROM\tPOS\tID\tREF\tALT\tCASE_GENO\tCTRL_GENO\tF_A\tF_U\tCHISQ\tP\tOR\tGENO_CHISQ\tGENO_P\n";
+
+		for (uint32_t variant = 0; variant < variants.size(); ++variant)
+		{
+			const VariantInfo& info = variants[variant];
+			const uint32_t* cases = &case_counts[3 * static_cast<size_t>(variant)];
+			const uint32_t* controls = &control_counts[3 * static_cast<size_t>(variant)];
+			const uint32_t case_called = cases[0] + cases[1] + cases[2];
+			const uint32_t control_called = controls[0] + controls[1] + controls[2];
+
+			out << info.chrom << '\t' << info.pos << '\t' << info.id << '\t' << info.ref << '\t' << info.alt << '\t'
+				<< cases[2] << '/' << cases[1] << '/' << cases[0] << '\t' << controls[2] << '/' << controls[1] << '/' << controls[0] << '\t';
+
+			number(case_called ? (cases[1] + 2.0 * cases[2]) / (2.0 * case_called) : std::numeric_limits<double>::quiet_NaN());
+			out << '\t';
+			number(control_called ? (controls[1] + 2.0 * controls[2]) / (2.0 * control_called) : std::numeric_limits<double>::quiet_NaN());
+			out << '\t';
+			number(allelic_chisq[variant]);
+			out << '\t';
+			number(allelic_p[variant]);
+			out << '\t';
+			number(odds_ratio[variant]);
+			out << '\t';
+			number(genotypic_chisq[variant]);
+			out << '\t';
+			number(genotypic_p[variant]);
+			out << '\n';
+		}
+
+		if (!out)
+			throw std::runtime_error("Failed to write " + path);
+	}
+};
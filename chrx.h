@@ -0,0 +1,223 @@
+#pragma once
+
+#include <fstream>
+#include <vector>
+#include <string>
+#include <stdexcept>
+#include <cstdint>
+#include <cmath>
+#include <limits>
+#include <utility>
+
+#include "plink2_reader.h"
+#include "sample_qc.h"
+#include "ld.h"
+
+inline bool isChromosomeX(const std::string& chrom)
+{
+	return chrom == "X" || chrom == "23" || chrom == "chrX";
+}
+
+// Male and diploid (female or unknown sex) samples as field masks over packed
+// rows: bit 0 of a sample's 2-bit field is set. Built once from SEX so X rules
+// are applied to whole words with no per-sample branching.
+struct SexMasks {
+	std::vector<uint8_t> sexes;
+	std::vector<uint64_t> male;
+	std::vector<uint64_t> diploid;
+	uint32_t male_count = 0;
+
+	explicit SexMasks(Plink2Reader& reader)
+		: male(reader.packed_words, 0), diploid(reader.packed_words, 0)
+	{
+		reader.readSampleSexes(sexes);
+
+		for (uint32_t sample = 0; sample < reader.sample_count; ++sample)
+		{
+			const uint64_t field = 1ULL << (2 * (sample % kGenotypesPerWord));
+
+			if (sexes[sample] == 1)
+			{
+				male[sample / kGenotypesPerWord] |= field;
+				male_count++;
+			}
+			else
+				diploid[sample / kGenotypesPerWord] |= field;
+		}
+	}
+};
+
+// Male X hets are not valid haploid calls: set them missing (01 -> 11)
+inline void setMaleHetsMissing(uint64_t* row, const uint64_t* male, uint32_t words)
+{
+	for (uint32_t word = 0; word < words; ++word)
+		row[word] |= (row[word] & ~(row[word] >> 1) & male[word]) << 1;
+}
+
+// Hardcall counts of one packed row over the samples in a field mask
+inline GenotypeCounts countMaskedGenotypes(const uint64_t* row, const uint64_t* mask, uint32_t words)
+{
+	GenotypeCounts counts = { 0, 0, 0, 0 };
+
+	for (uint32_t word = 0; word < words; ++word)
+	{
+		const uint64_t low = row[word] & mask[word];
+		const uint64_t high = (row[word] >> 1) & mask[word];
+
+		counts.hom_ref += popcount64(mask[word] & ~(low | high));
+		counts.het += popcount64(low & ~high);
+		counts.hom_alt += popcount64(high & ~low);
+		counts.missing += popcount64(low & high);
+	}
+
+	return counts;
+}
+
+struct AlleleCounts {
+	uint64_t alt;
+	uint64_t observed;
+};
+
+// ALT copies and allele observations of one packed X row with males haploid:
+// a male hom alt is one ALT copy, a male het is treated as missing
+inline AlleleCounts countXAlleles(const uint64_t* row, const SexMasks& masks, uint32_t words)
+{
+	AlleleCounts counts = { 0, 0 };
+
+	for (uint32_t word = 0; word < words; ++word)
+	{
+		const uint64_t low = row[word] & kMask5555;
+		const uint64_t high = (row[word] >> 1) & kMask5555;
+		const uint64_t het = low & ~high;
+		const uint64_t alt = high & ~low;
+		const uint64_t called = ~(low & high) & kMask5555;
+
+		counts.alt += popcount64(het & masks.diploid[word]) + 2ULL * popcount64(alt & masks.diploid[word]) + popcount64(alt & masks.male[word]);
+		counts.observed += 2ULL * popcount64(called & masks.diploid[word]) + popcount64(called & ~het & masks.male[word]);
+	}
+
+	return counts;
+}
+
+// [start, end) ranges of the chromosome X variants
+inline std::vector<std::pair<uint32_t, uint32_t>> chromosomeXRanges(const std::vector<VariantInfo>& variants)
+{
+	std::vector<std::pair<uint32_t, uint32_t>> ranges;
+
+	for (const auto& range : chromosomeRanges(variants))
+	{
+		if (isChromosomeX(variants[range.first].chrom))
+			ranges.push_back(range);
+	}
+
+	return ranges;
+}
+
+struct SexCheckOptions {
+	double female_max_f = 0.2;
+	double male_min_f = 0.8;
+	uint32_t thread_count = 1;
+};
+
+// Sex check from X homozygosity: inbreeding F over the X variants with every
+// sample treated as diploid, so males (one X) come out near 1. F above
+// male_min_f calls male, below female_max_f female; the call is compared with
+// SEX from the .psam.
+class SexCheck {
+private:
+	Plink2Reader& reader;
+	SexCheckOptions options;
+
+public:
+	std::vector<uint8_t> sexes;
+	std::vector<uint8_t> snp_sexes;
+	std::vector<double> f_values;
+	uint32_t x_variants = 0;
+
+	SexCheck(Plink2Reader& reader, const SexCheckOptions& options)
+		: reader(reader), options(options)
+	{
+	}
+
+	void compute()
+	{
+		std::vector<VariantInfo> variants;
+		reader.readVariantInfo(variants);
+
+		SampleQcOptions qc_options;
+		qc_options.thread_count = options.thread_count;
+		qc_options.variant_ranges = chromosomeXRanges(variants);
+
+		if (qc_options.variant_ranges.empty())
+			throw std::runtime_error("No chromosome X variants for the sex check");
+
+		SampleQcEngine qc(reader, qc_options);
+		qc.compute();
+
+		x_variants = qc.variants_used;
+		reader.readSampleSexes(sexes);
+
+		snp_sexes.assign(reader.sample_count, 0);
+		f_values.assign(reader.sample_count, std::numeric_limits<double>::quiet_NaN());
+
+		for (uint32_t sample = 0; sample < reader.sample_count; ++sample)
+		{
+			const double called = x_variants - qc.missing_counts[sample];
+			const double expected = qc.expected_hom[sample];
+
+			if (called <= expected)
+				continue;
+
+			f_values[sample] = (called - qc.het_counts[sample] - expected) / (called - expected);
+
+			if (f_values[sample] > options.male_min_f)
+				snp_sexes[sample] = 1;
+			else if (f_values[sample] < options.female_max_f)
+				snp_sexes[sample] = 2;
+		}
+	}
+
+	uint32_t problemCount() const
+	{
+		uint32_t problems = 0;
+
+		for (uint32_t sample = 0; sample < sexes.size(); ++sample)
+			problems += !sexes[sample] || sexes[sample] != snp_sexes[sample];
+
+		return problems;
+	}
+
+	// <prefix>.sexcheck: .psam sex, sex called from X, OK/PROBLEM and F
+	void write(const std::string& prefix)
+	{
+		compute();
+
+		std::vector<std::string> labels;
+		const bool has_fid = readSampleLabels(reader, labels);
+
+		std::ofstream out(prefix + ".sexcheck");
+
+		if (!out.is_open())
+			throw std::runtime_error("Failed to open " + prefix + ".sexcheck");
+
+		out << (has_fid ? "#FID\tIID" : "#IID") << "\tPEDSEX\tSNPSEX\tSTATUS\tF\n";
+
+		for (uint32_t sample = 0; sample < reader.sample_count; ++sample)
+		{
+			const bool ok = sexes[sample] && sexes[sample] == snp_sexes[sample];
+
+			out << labels[sample] << '\t' << static_cast<uint32_t>(sexes[sample]) << '\t' << static_cast<uint32_t>(snp_sexes[sample])
+				<< '\t' << (ok ? "OK" : "PROBLEM") << '\t';
+
+			if (std::isnan(f_values[sample]))
+				out << "NA";
+			else
+				out << f_values[sample];
+
+			out << '\n';
+		}
+
+		if (!out)
+			throw std::runtime_error("Failed to write " + prefix + ".sexcheck");
+	}
+};
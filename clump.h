@@ -0,0 +1,245 @@
+#pragma once
+
+#include <fstream>
+#include <sstream>
+#include <vector>
+#include <string>
+#include <unordered_map>
+#include <stdexcept>
+#include <cstdint>
+#include <cmath>
+#include <limits>
+#include <algorithm>
+
+#include "plink2_reader.h"
+#include "parallel.h"
+#include "ld.h"
+
+struct ClumpOptions {
+	// Index variants need p <= index_p; clump members p <= member_p
+	double index_p = 1e-4;
+	double member_p = 0.01;
+	double r2_threshold = 0.5;
+	uint32_t window_kb = 250;
+	uint32_t thread_count = 1;
+};
+
+struct Clump {
+	uint32_t index_variant;
+	std::vector<uint32_t> members;
+};
+
+// p-values from a whitespace-delimited summary statistics file with a header
+// naming an ID (or SNP) column and a P column, such as a .glm.linear file;
+// variants absent from the file or with a missing p are NaN
+inline void readSummaryPValues(const std::string& path, const std::vector<VariantInfo>& variants, std::vector<double>& p_values)
+{
+	std::ifstream file(path);
+
+	if (!file.is_open())
+		throw std::runtime_error("Failed to open " + path);
+
+	std::string line;
+	std::vector<std::string> fields;
+
+	auto split = [&](const std::string& text)
+	{
+		std::istringstream stream(!text.empty() && text[0] == '#' ? text.substr(1) : text);
+		fields.clear();
+
+		for (std::string field; stream >> field; )
+			fields.push_back(field);
+	};
+
+	if (!std::getline(file, line))
+		throw std::runtime_error(path + " is empty");
+
+	split(line);
+
+	auto id_it = std::find(fields.begin(), fields.end(), "ID");
+
+	if (id_it == fields.end())
+		id_it = std::find(fields.begin(), fields.end(), "SNP");
+
+	const auto p_it = std::find(fields.begin(), fields.end(), "P");
+
+	if (id_it == fields.end() || p_it == fields.end())
+		throw std::runtime_error(path + " needs ID and P columns");
+
+	const size_t id_index = id_it - fields.begin();
+	const size_t p_index = p_it - fields.begin();
+	const size_t column_count = fields.size();
+
+	std::unordered_map<std::string, uint32_t> variant_index;
+
+	for (uint32_t variant = 0; variant < variants.size(); ++variant)
+		variant_index.emplace(variants[variant].id, variant);
+
+	p_values.assign(variants.size(), std::numeric_limits<double>::quiet_NaN());
+
+	while (std::getline(file, line))
+	{
+		split(line);
+
+		if (fields.empty())
+			continue;
+
+		if (fields.size() != column_count)
+			throw std::runtime_error("Malformed line in " + path);
+
+		const auto it = variant_index.find(fields[id_index]);
+
+		if (it == variant_index.end() || fields[p_index] == "NA")
+			continue;
+
+		p_values[it->second] = std::stod(fields[p_index]);
+	}
+}
+
+// Greedy LD clumping. Index variants are taken in order of p; each claims the
+// not yet clumped variants within window_kb on its chromosome that pass
+// member_p and have r^2 >= r2_threshold with it. Genotypes are fetched one
+// variant at a time by random access, so only variants near significant
+// hits are ever decoded; enabling the reader's block cache lets neighbouring
+// index variants share decoded blocks.
+class LdClumper {
+private:
+	Plink2Reader& reader;
+	ClumpOptions options;
+
+	std::vector<VariantInfo> variants;
+	std::vector<double> p_values;
+
+public:
+	std::vector<Clump> clumps;
+
+	LdClumper(Plink2Reader& reader, const ClumpOptions& options, const std::string& summary_path)
+		: reader(reader), options(options)
+	{
+		if (options.index_p > options.member_p)
+			throw std::invalid_argument("Index p threshold must not exceed the member threshold");
+
+		reader.readVariantInfo(variants);
+		readSummaryPValues(summary_path, variants, p_values);
+	}
+
+	void compute()
+	{
+		const uint32_t sample_count = reader.sample_count;
+		const uint32_t plane_words = (sample_count + 63) / 64;
+		const uint64_t window = static_cast<uint64_t>(options.window_kb) * 1000;
+		const uint32_t threads = std::max(1u, options.thread_count);
+
+		std::vector<uint32_t> order;
+
+		for (uint32_t variant = 0; variant < variants.size(); ++variant)
+		{
+			if (p_values[variant] <= options.index_p)
+				order.push_back(variant);
+		}
+
+		std::stable_sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) { return p_values[a] < p_values[b]; });
+
+		std::vector<uint8_t> clumped(variants.size(), 0);
+		std::vector<uint32_t> candidates;
+		std::vector<double> r2;
+
+		// Per-thread decode scratch
+		std::vector<std::vector<uint64_t>> packed(threads);
+		std::vector<std::vector<uint64_t>> planes(threads, std::vector<uint64_t>(5 * static_cast<size_t>(plane_words)));
+
+		std::vector<uint64_t> index_planes(3 * static_cast<size_t>(plane_words));
+
+		clumps.clear();
+
+		for (const uint32_t index : order)
+		{
+			if (clumped[index])
+				continue;
+
+			clumped[index] = 1;
+
+			const VariantInfo& info = variants[index];
+			candidates.clear();
+
+			auto consider = [&](uint32_t variant)
+			{
+				if (!clumped[variant] && p_values[variant] <= options.member_p)
+					candidates.push_back(variant);
+			};
+
+			for (uint32_t variant = index; variant-- > 0 && variants[variant].chrom == info.chrom && info.pos - static_cast<uint64_t>(variants[variant].pos) <= window; )
+				consider(variant);
+
+			for (uint32_t variant = index + 1; variant < variants.size() && variants[variant].chrom == info.chrom && variants[variant].pos - static_cast<uint64_t>(info.pos) <= window; ++variant)
+				consider(variant);
+
+			Clump clump = { index, {} };
+
+			if (!candidates.empty())
+			{
+				reader.readPackedVariants(packed[0], index, index + 1);
+
+				const LdStats index_stats = buildLdPlanes(packed[0].data(), sample_count, index_planes.data(), planes[0].data(), planes[0].data() + plane_words);
+
+				r2.resize(candidates.size());
+
+				parallelFor(static_cast<uint32_t>(candidates.size()), threads,
+					[&](uint32_t c, uint32_t thread_index)
+					{
+						std::vector<uint64_t>& row = packed[thread_index];
+						uint64_t* scratch = planes[thread_index].data();
+
+						reader.readPackedVariants(row, candidates[c], candidates[c] + 1);
+
+						const LdStats stats = buildLdPlanes(row.data(), sample_count, scratch + 2 * plane_words, scratch, scratch + plane_words);
+						r2[c] = ldR2(index_planes.data(), index_stats, scratch + 2 * plane_words, stats, plane_words);
+					});
+
+				for (uint32_t c = 0; c < candidates.size(); ++c)
+				{
+					if (r2[c] >= options.r2_threshold)
+					{
+						clump.members.push_back(candidates[c]);
+						clumped[candidates[c]] = 1;
+					}
+				}
+
+				std::sort(clump.members.begin(), clump.members.end());
+			}
+
+			clumps.push_back(std::move(clump));
+		}
+	}
+
+	// <prefix>.clumps: one line per clump in order of index p, with member IDs in SP2
+	void write(const std::string& prefix)
+	{
+		compute();
+
+		std::ofstream out(prefix + ".clumps");
+
+		if (!out.is_open())
+			throw std::runtime_error("Failed to open " + prefix + ".clumps");
+
+		out << "#CHROM\tPOS\tID\tP\tTOTAL\tSP2\n";
+
+		for (const Clump& clump : clumps)
+		{
+			const VariantInfo& info = variants[clump.index_variant];
+
+			out << info.chrom << '\t' << info.pos << '\t' << info.id << '\t' << p_values[clump.index_variant] << '\t' << clump.members.size() << '\t';
+
+			if (clump.members.empty())
+				out << '.';
+
+			for (size_t m = 0; m < clump.members.size(); ++m)
+				out << (m ? "," : "") << variants[clump.members[m]].id;
+
+			out << '\n';
+		}
+
+		if (!out)
+			throw std::runtime_error("Failed to write " + prefix + ".clumps");
+	}
+};
@@ -0,0 +1,295 @@
+#pragma once
+
+#include <fstream>
+#include <vector>
+#include <string>
+#include <unordered_map>
+#include <stdexcept>
+#include <cstdint>
+#include <utility>
+#include <algorithm>
+
+#include "plink2_reader.h"
+#include "parallel.h"
+
+// splitmix64 finalizer
+inline uint64_t mix64(uint64_t x)
+{
+	x ^= x >> 30;
+	x *= 0xbf58476d1ce4e5b9ULL;
+	x ^= x >> 27;
+	x *= 0x94d049bb133111ebULL;
+	x ^= x >> 31;
+	return x;
+}
+
+// Hash of a packed row (padding fields clear)
+inline uint64_t hashPackedRow(const uint64_t* row, uint32_t words)
+{
+	uint64_t hash = 0x9e3779b97f4a7c15ULL;
+
+	for (uint32_t word = 0; word < words; ++word)
+		hash = mix64(hash ^ row[word]) + word;
+
+	return hash;
+}
+
+struct DuplicateOptions {
+	uint32_t block_variants = 4096;
+	uint32_t thread_count = 1;
+};
+
+// Variants with identical genotype records and samples with identical
+// genotype vectors (missing calls included). One streaming pass hashes each
+// decoded row, and adds to every sample's hash a random key of (variant,
+// genotype) for each of its non-hom-ref fields, walking sample words in
+// parallel; the sample hash is thus a sum that needs no per-sample buffer.
+// A variant whose hash was seen before is compared with that variant's row
+// (re-read if it has left the block) before it is reported. Samples sharing
+// a hash are checked in a second pass over only those samples, made only when
+// such collisions exist. Memory is one hash per variant and per sample.
+class DuplicateDetector {
+private:
+	Plink2Reader& reader;
+	DuplicateOptions options;
+
+	// Key added to a sample's hash for genotype code 1..3 at a variant
+	static uint64_t genotypeKey(uint32_t variant, uint32_t code)
+	{
+		return mix64(4ULL * variant + code);
+	}
+
+	void hashVariants()
+	{
+		const uint32_t variant_count = reader.variant_count;
+		const uint32_t words = reader.packed_words;
+
+		std::unordered_map<uint64_t, uint32_t> first_with_hash;
+		std::vector<uint64_t> row_hashes, packed, earlier;
+
+		first_with_hash.reserve(variant_count);
+		sample_hashes.assign(reader.sample_count, 0);
+		variant_groups.assign(variant_count, kUnique);
+
+		for (uint32_t start = 0; start < variant_count; start += options.block_variants)
+		{
+			const uint32_t end = std::min(start + options.block_variants, variant_count);
+
+			reader.readPackedVariants(packed, start, end);
+			row_hashes.resize(end - start);
+
+			parallelFor(end - start, options.thread_count,
+				[&](uint32_t offset, uint32_t)
+				{
+					row_hashes[offset] = hashPackedRow(&packed[static_cast<size_t>(offset) * words], words);
+				});
+
+			// One task per 32-sample word, so every task owns its samples' hashes
+			parallelFor(words, options.thread_count,
+				[&](uint32_t word, uint32_t)
+				{
+					for (uint32_t variant = start; variant < end; ++variant)
+					{
+						const uint64_t fields = packed[static_cast<size_t>(variant - start) * words + word];
+
+						for (uint64_t nonzero = (fields | (fields >> 1)) & kMask5555; nonzero; nonzero &= nonzero - 1)
+						{
+							const uint32_t bit = static_cast<uint32_t>(__builtin_ctzll(nonzero));
+							sample_hashes[word * kGenotypesPerWord + bit / 2] += genotypeKey(variant, static_cast<uint32_t>((fields >> bit) & 3));
+						}
+					}
+				});
+
+			// Collisions are checked in variant order, so the output is deterministic
+			for (uint32_t variant = start; variant < end; ++variant)
+			{
+				auto inserted = first_with_hash.emplace(row_hashes[variant - start], variant);
+
+				if (inserted.second)
+					continue;
+
+				const uint32_t first = inserted.first->second;
+				const uint64_t* row = &packed[static_cast<size_t>(variant - start) * words];
+				const uint64_t* first_row;
+
+				if (first >= start)
+					first_row = &packed[static_cast<size_t>(first - start) * words];
+				else
+				{
+					reader.readPackedVariants(earlier, first, first + 1);
+					first_row = earlier.data();
+				}
+
+				if (std::equal(row, row + words, first_row))
+					variant_groups[variant] = variant_groups[first] = first;
+				else
+					unverified_collisions++;
+			}
+		}
+	}
+
+	void verifySamples()
+	{
+		const uint32_t sample_count = reader.sample_count;
+		std::vector<std::pair<uint64_t, uint32_t>> order(sample_count);
+
+		sample_groups.assign(sample_count, kUnique);
+
+		for (uint32_t sample = 0; sample < sample_count; ++sample)
+			order[sample] = { sample_hashes[sample], sample };
+
+		std::sort(order.begin(), order.end());
+
+		// Candidate (sample, first sample with its hash) pairs
+		std::vector<std::pair<uint32_t, uint32_t>> candidates;
+
+		for (uint32_t i = 1, run_start = 0; i < sample_count; ++i)
+		{
+			if (order[i].first != order[run_start].first)
+				run_start = i;
+			else
+				candidates.emplace_back(order[i].second, order[run_start].second);
+		}
+
+		if (candidates.empty())
+			return;
+
+		std::vector<uint8_t> equal(candidates.size(), 1);
+		std::vector<uint64_t> packed;
+
+		for (uint32_t start = 0; start < reader.variant_count; start += options.block_variants)
+		{
+			const uint32_t end = std::min(start + options.block_variants, reader.variant_count);
+
+			reader.readPackedVariants(packed, start, end);
+
+			parallelFor(static_cast<uint32_t>(candidates.size()), options.thread_count,
+				[&](uint32_t candidate, uint32_t)
+				{
+					const uint32_t sample = candidates[candidate].first;
+					const uint32_t first = candidates[candidate].second;
+
+					for (uint32_t variant = start; variant < end && equal[candidate]; ++variant)
+					{
+						const uint64_t* row = &packed[static_cast<size_t>(variant - start) * reader.packed_words];
+						equal[candidate] = getPackedGenotype(row, sample) == getPackedGenotype(row, first);
+					}
+				});
+		}
+
+		for (uint32_t candidate = 0; candidate < candidates.size(); ++candidate)
+		{
+			if (!equal[candidate])
+			{
+				unverified_collisions++;
+				continue;
+			}
+
+			sample_groups[candidates[candidate].first] = candidates[candidate].second;
+			sample_groups[candidates[candidate].second] = candidates[candidate].second;
+		}
+	}
+
+	// Members of every group, each group in order of its first member
+	static std::vector<std::vector<uint32_t>> collectGroups(const std::vector<uint32_t>& groups)
+	{
+		std::vector<std::vector<uint32_t>> members;
+		std::unordered_map<uint32_t, uint32_t> index;
+
+		for (uint32_t item = 0; item < groups.size(); ++item)
+		{
+			if (groups[item] == kUnique)
+				continue;
+
+			auto inserted = index.emplace(groups[item], static_cast<uint32_t>(members.size()));
+
+			if (inserted.second)
+				members.emplace_back();
+
+			members[inserted.first->second].push_back(item);
+		}
+
+		std::sort(members.begin(), members.end());
+		return members;
+	}
+
+public:
+	static constexpr uint32_t kUnique = 0xffffffffu;
+
+	// Per variant / sample: the first member of its duplicate group, or kUnique
+	std::vector<uint32_t> variant_groups;
+	std::vector<uint32_t> sample_groups;
+	std::vector<uint64_t> sample_hashes;
+
+	// Members of every duplicate group
+	std::vector<std::vector<uint32_t>> duplicate_variants;
+	std::vector<std::vector<uint32_t>> duplicate_samples;
+
+	// Hash collisions that verification showed to differ
+	uint32_t unverified_collisions = 0;
+
+	DuplicateDetector(Plink2Reader& reader, const DuplicateOptions& options)
+		: reader(reader), options(options)
+	{
+		if (options.block_variants == 0)
+			throw std::invalid_argument("Duplicate scan block size must be nonzero");
+	}
+
+	void compute()
+	{
+		unverified_collisions = 0;
+		hashVariants();
+		verifySamples();
+
+		duplicate_variants = collectGroups(variant_groups);
+		duplicate_samples = collectGroups(sample_groups);
+	}
+
+	// <prefix>.dupvar and <prefix>.dupsample: one line per member of every
+	// duplicate group, groups numbered from 1 in order of their first member
+	void write(const std::string& prefix)
+	{
+		compute();
+
+		std::vector<VariantInfo> variants;
+		reader.readVariantInfo(variants);
+
+		std::ofstream out(prefix + ".dupvar");
+
+		if (!out.is_open())
+			throw std::runtime_error("Failed to open " + prefix + ".dupvar");
+
+		out << "#GROUP\tCHROM\tPOS\tID\tREF\tALT\n";
+
+		for (uint32_t group = 0; group < duplicate_variants.size(); ++group)
+		{
+			for (uint32_t variant : duplicate_variants[group])
+			{
+				const VariantInfo& info = variants[variant];
+				out << group + 1 << '\t' << info.chrom << '\t' << info.pos << '\t' << info.id << '\t' << info.ref << '\t' << info.alt << '\n';
+			}
+		}
+
+		if (!out)
+			throw std::runtime_error("Failed to write " + prefix + ".dupvar");
+
+		std::vector<std::string> labels;
+		const bool has_fid = readSampleLabels(reader, labels);
+
+		std::ofstream samples_out(prefix + ".dupsample");
+
+		if (!samples_out.is_open())
+			throw std::runtime_error("Failed to open " + prefix + ".dupsample");
+
+		samples_out << (has_fid ? "#GROUP\tFID\tIID\n" : "#GROUP\tIID\n");
+
+		for (uint32_t group = 0; group < duplicate_samples.size(); ++group)
+		{
+			for (uint32_t sample : duplicate_samples[group])
+				samples_out << group + 1 << '\t' << labels[sample] << '\n';
+		}
+
+		if (!samples_out)
+			throw std::runtime_error("Failed to write " + prefix + ".dupsample");
+	}
+};
@@ -0,0 +1,506 @@
+#pragma once
+
+#include <fstream>
+#include <vector>
+#include <string>
+#include <stdexcept>
+#include <cstdint>
+#include <cmath>
+#include <algorithm>
+
+#include "plink2_reader.h"
+#include "parallel.h"
+#include "linear_algebra.h"
+
+struct EpistasisOptions {
+	// Variants per tile; the pair triangle is split into tile x tile tasks
+	uint32_t tile_variants = 32;
+
+	// Bytes of bit planes held at once; bounds the strip of first variants
+	uint64_t memory_budget = 1ULL << 30;
+
+	// Pairs with an interaction p below this are reported
+	double report_p = 1e-4;
+
+	uint32_t thread_count = 1;
+};
+
+struct EpistasisResult {
+	uint32_t first;
+	uint32_t second;
+	double statistic;
+	double p;
+};
+
+// Upper tail of the 4 degree of freedom chi-square
+inline double chiSquare4PValue(double statistic)
+{
+	return statistic > 0.0 ? std::exp(-statistic / 2.0) * (1.0 + statistic / 2.0) : 1.0;
+}
+
+// Likelihood ratio statistic 2 sum n log(n / m) of a table against fitted values
+inline double likelihoodRatio(const double* n, const double* m, uint32_t cells)
+{
+	double statistic = 0.0;
+
+	for (uint32_t cell = 0; cell < cells; ++cell)
+	{
+		if (n[cell] > 0.0)
+			statistic += n[cell] * std::log(n[cell] / m[cell]);
+	}
+
+	return 2.0 * statistic;
+}
+
+// Case/control SNP x SNP interaction scan (BOOST). Each variant is held as six
+// bit planes: hom ref, het and hom alt of the cases, then of the controls, so
+// the 2 x 3 x 3 table of a pair takes at most 18 AND + popcounts per 64
+// samples. The interaction is the log-linear likelihood ratio test of no
+// three-way association (4 df). Pairs are screened with the closed-form
+// Kirkwood superposition approximation, whose statistic bounds the exact one
+// from above; only pairs passing the screen get the exact fit by iterative
+// proportional fitting. Variants are handled in strips sized to the memory
+// budget, and each strip's pairs in tiles run in parallel.
+class EpistasisScan {
+private:
+	Plink2Reader& reader;
+	EpistasisOptions options;
+
+	uint32_t plane_words;
+	std::vector<uint64_t> case_mask;
+	std::vector<uint64_t> control_mask;
+
+	double critical_value;
+
+	// x log x for every possible count
+	std::vector<double> xlogx;
+
+	static constexpr uint32_t kPlanes = 6;
+
+	// Planes of [start_variant, end_variant), and per variant its six plane
+	// popcounts plus its missing call count among cases and controls
+	void buildPlanes(uint32_t start_variant, uint32_t end_variant, std::vector<uint64_t>& planes, std::vector<uint32_t>& counts)
+	{
+		const uint32_t words = reader.packed_words;
+		std::vector<uint64_t> packed;
+		std::vector<uint64_t> low(plane_words), high(plane_words);
+
+		reader.readPackedVariants(packed, start_variant, end_variant);
+		planes.resize(static_cast<size_t>(end_variant - start_variant) * kPlanes * plane_words);
+		counts.assign(static_cast<size_t>(end_variant - start_variant) * (kPlanes + 1), 0);
+
+		for (uint32_t variant = start_variant; variant < end_variant; ++variant)
+		{
+			uint64_t* out = &planes[static_cast<size_t>(variant - start_variant) * kPlanes * plane_words];
+			uint32_t* count = &counts[static_cast<size_t>(variant - start_variant) * (kPlanes + 1)];
+
+			splitBitPlanes(&packed[static_cast<size_t>(variant - start_variant) * words], reader.sample_count, low.data(), high.data());
+
+			for (uint32_t word = 0; word < plane_words; ++word)
+			{
+				const uint64_t ref = ~(low[word] | high[word]);
+				const uint64_t het = low[word] & ~high[word];
+				const uint64_t alt = high[word] & ~low[word];
+
+				out[word] = ref & case_mask[word];
+				out[plane_words + word] = het & case_mask[word];
+				out[2 * plane_words + word] = alt & case_mask[word];
+				out[3 * plane_words + word] = ref & control_mask[word];
+				out[4 * plane_words + word] = het & control_mask[word];
+				out[5 * plane_words + word] = alt & control_mask[word];
+
+				for (uint32_t plane = 0; plane < kPlanes; ++plane)
+					count[plane] += popcount64(out[plane * plane_words + word]);
+
+				count[kPlanes] += popcount64(low[word] & high[word] & (case_mask[word] | control_mask[word]));
+			}
+		}
+	}
+
+	// table[9 * stratum + 3 * a + b]: samples of the stratum with genotype a at
+	// the first variant and b at the second, both called. Without missing calls
+	// at either variant the hom ref row and column follow from the variants'
+	// genotype counts, so only the four het / hom alt cells are popcounted.
+	void pairTable(const uint64_t* a, const uint32_t* a_counts, const uint64_t* b, const uint32_t* b_counts, uint32_t table[18]) const
+	{
+		const bool complete = !a_counts[kPlanes] && !b_counts[kPlanes];
+
+		for (uint32_t stratum = 0; stratum < 2; ++stratum)
+		{
+			const uint64_t* a0 = a + 3 * stratum * plane_words;
+			const uint64_t* a1 = a0 + plane_words;
+			const uint64_t* a2 = a1 + plane_words;
+			const uint64_t* b0 = b + 3 * stratum * plane_words;
+			const uint64_t* b1 = b0 + plane_words;
+			const uint64_t* b2 = b1 + plane_words;
+			uint32_t* cell = table + 9 * stratum;
+
+			// Kept in registers across the word loop
+			uint32_t c11 = 0, c12 = 0, c21 = 0, c22 = 0;
+
+			if (complete)
+			{
+				for (uint32_t word = 0; word < plane_words; ++word)
+				{
+					c11 += popcount64(a1[word] & b1[word]);
+					c12 += popcount64(a1[word] & b2[word]);
+					c21 += popcount64(a2[word] & b1[word]);
+					c22 += popcount64(a2[word] & b2[word]);
+				}
+
+				const uint32_t* ra = a_counts + 3 * stratum;
+				const uint32_t* rb = b_counts + 3 * stratum;
+
+				cell[4] = c11; cell[5] = c12;
+				cell[7] = c21; cell[8] = c22;
+				cell[3] = ra[1] - c11 - c12;
+				cell[6] = ra[2] - c21 - c22;
+				cell[1] = rb[1] - c11 - c21;
+				cell[2] = rb[2] - c12 - c22;
+				cell[0] = rb[0] - cell[3] - cell[6];
+				continue;
+			}
+
+			uint32_t c00 = 0, c01 = 0, c02 = 0, c10 = 0, c20 = 0;
+
+			for (uint32_t word = 0; word < plane_words; ++word)
+			{
+				c00 += popcount64(a0[word] & b0[word]);
+				c01 += popcount64(a0[word] & b1[word]);
+				c02 += popcount64(a0[word] & b2[word]);
+				c10 += popcount64(a1[word] & b0[word]);
+				c11 += popcount64(a1[word] & b1[word]);
+				c12 += popcount64(a1[word] & b2[word]);
+				c20 += popcount64(a2[word] & b0[word]);
+				c21 += popcount64(a2[word] & b1[word]);
+				c22 += popcount64(a2[word] & b2[word]);
+			}
+
+			cell[0] = c00; cell[1] = c01; cell[2] = c02;
+			cell[3] = c10; cell[4] = c11; cell[5] = c12;
+			cell[6] = c20; cell[7] = c21; cell[8] = c22;
+		}
+	}
+
+	// Exact no-three-way-interaction fit of a 2 x 3 x 3 table by iterative
+	// proportional fitting to its three two-way margins
+	static double interactionStatistic(const uint32_t counts[18])
+	{
+		double n[18], ab[9] = {}, sa[6] = {}, sb[6] = {};
+
+		std::copy(counts, counts + 18, n);
+
+		for (uint32_t s = 0; s < 2; ++s)
+		{
+			for (uint32_t i = 0; i < 3; ++i)
+			{
+				for (uint32_t j = 0; j < 3; ++j)
+				{
+					const double value = n[9 * s + 3 * i + j];
+					ab[3 * i + j] += value;
+					sa[3 * s + i] += value;
+					sb[3 * s + j] += value;
+				}
+			}
+		}
+
+		double m[18];
+		std::fill(m, m + 18, 1.0);
+
+		for (uint32_t iteration = 0; iteration < 100; ++iteration)
+		{
+			double fitted[9] = {};
+			double change = 0.0;
+
+			for (uint32_t cell = 0; cell < 18; ++cell)
+				fitted[cell % 9] += m[cell];
+
+			for (uint32_t cell = 0; cell < 18; ++cell)
+				m[cell] = fitted[cell % 9] > 0.0 ? m[cell] * ab[cell % 9] / fitted[cell % 9] : 0.0;
+
+			double fitted_sa[6] = {};
+
+			for (uint32_t cell = 0; cell < 18; ++cell)
+				fitted_sa[3 * (cell / 9) + (cell % 9) / 3] += m[cell];
+
+			for (uint32_t cell = 0; cell < 18; ++cell)
+			{
+				const uint32_t margin = 3 * (cell / 9) + (cell % 9) / 3;
+				m[cell] = fitted_sa[margin] > 0.0 ? m[cell] * sa[margin] / fitted_sa[margin] : 0.0;
+			}
+
+			double fitted_sb[6] = {};
+
+			for (uint32_t cell = 0; cell < 18; ++cell)
+				fitted_sb[3 * (cell / 9) + cell % 3] += m[cell];
+
+			for (uint32_t cell = 0; cell < 18; ++cell)
+			{
+				const uint32_t margin = 3 * (cell / 9) + cell % 3;
+				const double scaled = fitted_sb[margin] > 0.0 ? m[cell] * sb[margin] / fitted_sb[margin] : 0.0;
+
+				change = std::max(change, std::fabs(scaled - m[cell]));
+				m[cell] = scaled;
+			}
+
+			if (change < 1e-8)
+				break;
+		}
+
+		return likelihoodRatio(n, m, 18);
+	}
+
+	// Kirkwood superposition approximation: m proportional to
+	// n_ij n_si n_sj / (n_i n_j n_s), normalized to the table total N. Expanding
+	// sum n log m over the margins leaves only x log x terms of counts, which are
+	// looked up, and a single log of the normalizer.
+	double ksaStatistic(const uint32_t n[18]) const
+	{
+		uint32_t ab[9] = {}, sa[6] = {}, sb[6] = {}, a[3] = {}, b[3] = {}, s[2] = {};
+		double cells = 0.0;
+
+		for (uint32_t cell = 0; cell < 18; ++cell)
+		{
+			const uint32_t k = cell / 9, i = (cell % 9) / 3, j = cell % 3;
+
+			ab[3 * i + j] += n[cell];
+			sa[3 * k + i] += n[cell];
+			sb[3 * k + j] += n[cell];
+			cells += xlogx[n[cell]];
+		}
+
+		for (uint32_t i = 0; i < 3; ++i)
+		{
+			a[i] = sa[i] + sa[3 + i];
+			b[i] = sb[i] + sb[3 + i];
+		}
+
+		s[0] = sa[0] + sa[1] + sa[2];
+		s[1] = sa[3] + sa[4] + sa[5];
+
+		const uint32_t total = s[0] + s[1];
+
+		// Empty margins have empty cells, so their reciprocal can be 0
+		double inv_a[3], inv_b[3], inv_s[2];
+
+		for (uint32_t i = 0; i < 3; ++i)
+		{
+			inv_a[i] = a[i] ? 1.0 / a[i] : 0.0;
+			inv_b[i] = b[i] ? 1.0 / b[i] : 0.0;
+		}
+
+		inv_s[0] = s[0] ? 1.0 / s[0] : 0.0;
+		inv_s[1] = s[1] ? 1.0 / s[1] : 0.0;
+
+		double q_total = 0.0;
+
+		for (uint32_t k = 0; k < 2; ++k)
+		{
+			double stratum = 0.0;
+
+			for (uint32_t i = 0; i < 3; ++i)
+			{
+				double row = 0.0;
+
+				for (uint32_t j = 0; j < 3; ++j)
+					row += static_cast<double>(ab[3 * i + j]) * sb[3 * k + j] * inv_b[j];
+
+				stratum += row * sa[3 * k + i] * inv_a[i];
+			}
+
+			q_total += stratum * inv_s[k];
+		}
+
+		if (q_total <= 0.0)
+			return 0.0;
+
+		double margins = 0.0;
+
+		for (uint32_t index = 0; index < 9; ++index)
+			margins += xlogx[ab[index]];
+
+		for (uint32_t index = 0; index < 6; ++index)
+			margins += xlogx[sa[index]] + xlogx[sb[index]];
+
+		for (uint32_t index = 0; index < 3; ++index)
+			margins -= xlogx[a[index]] + xlogx[b[index]];
+
+		margins -= xlogx[s[0]] + xlogx[s[1]];
+
+		return 2.0 * (cells - margins + total * std::log(q_total / total));
+	}
+
+public:
+	std::vector<EpistasisResult> results;
+	uint64_t pairs_tested = 0;
+	uint64_t pairs_refitted = 0;
+
+	EpistasisScan(Plink2Reader& reader, const Matrix& phenotype, const EpistasisOptions& options)
+		: reader(reader), options(options), plane_words((reader.sample_count + 63) / 64),
+		  case_mask(plane_words, 0), control_mask(plane_words, 0)
+	{
+		if (options.tile_variants == 0)
+			throw std::invalid_argument("Epistasis tile size must be nonzero");
+
+		if (!(options.report_p > 0.0 && options.report_p <= 1.0))
+			throw std::invalid_argument("Epistasis report p must be in (0, 1]");
+
+		if (phenotype.rows != reader.sample_count)
+			throw std::invalid_argument("Phenotype does not match the sample count");
+
+		uint32_t case_count = 0, control_count = 0;
+
+		for (uint32_t sample = 0; sample < phenotype.rows; ++sample)
+		{
+			if (phenotype(sample, 0) == 1.0)
+			{
+				case_mask[sample / 64] |= 1ULL << (sample % 64);
+				case_count++;
+			}
+			else if (phenotype(sample, 0) == 0.0)
+			{
+				control_mask[sample / 64] |= 1ULL << (sample % 64);
+				control_count++;
+			}
+		}
+
+		if (!case_count || !control_count)
+			throw std::runtime_error("Epistasis scan needs both cases and controls");
+
+		// Statistic at which the 4 df p reaches report_p, by bisection
+		double low = 0.0, high = 4000.0;
+
+		for (int step = 0; step < 200; ++step)
+		{
+			const double middle = 0.5 * (low + high);
+
+			if (chiSquare4PValue(middle) > options.report_p)
+				low = middle;
+			else
+				high = middle;
+		}
+
+		critical_value = high;
+
+		xlogx.resize(static_cast<size_t>(reader.sample_count) + 1);
+
+		for (uint32_t x = 0; x <= reader.sample_count; ++x)
+			xlogx[x] = x ? x * std::log(static_cast<double>(x)) : 0.0;
+	}
+
+	void compute()
+	{
+		const uint32_t variant_count = reader.variant_count;
+		const uint32_t tile = options.tile_variants;
+		const uint32_t threads = std::max(1u, options.thread_count);
+		const size_t variant_bytes = static_cast<size_t>(kPlanes) * plane_words * 8;
+
+		// Half the budget for the strip of first variants, half for the second-variant block
+		const uint32_t strip_variants = static_cast<uint32_t>(std::max<uint64_t>(options.memory_budget / 2 / variant_bytes / tile, 1) * tile);
+
+		std::vector<uint64_t> strip_planes, block_planes;
+		std::vector<uint32_t> strip_counts, block_counts;
+		std::vector<std::vector<EpistasisResult>> found(threads);
+		std::vector<uint64_t> refitted(threads, 0);
+
+		results.clear();
+		pairs_tested = pairs_refitted = 0;
+
+		for (uint32_t strip_start = 0; strip_start < variant_count; strip_start += strip_variants)
+		{
+			const uint32_t strip_end = std::min(strip_start + strip_variants, variant_count);
+
+			buildPlanes(strip_start, strip_end, strip_planes, strip_counts);
+
+			// Second variants b < a come from earlier blocks, then the strip itself
+			for (uint32_t block_start = 0; block_start < strip_end; block_start += strip_variants)
+			{
+				const uint32_t block_end = std::min(block_start + strip_variants, strip_end);
+				const bool same = block_start == strip_start;
+
+				if (!same)
+					buildPlanes(block_start, block_end, block_planes, block_counts);
+
+				const std::vector<uint64_t>& second_planes = same ? strip_planes : block_planes;
+				const std::vector<uint32_t>& second_counts = same ? strip_counts : block_counts;
+
+				std::vector<std::pair<uint32_t, uint32_t>> tasks;
+
+				for (uint32_t ta = strip_start; ta < strip_end; ta += tile)
+				{
+					for (uint32_t tb = block_start; tb < block_end && tb < ta + tile; tb += tile)
+						tasks.emplace_back(ta, tb);
+				}
+
+				parallelFor(static_cast<uint32_t>(tasks.size()), threads,
+					[&](uint32_t task, uint32_t thread_index)
+					{
+						const uint32_t a_end = std::min(tasks[task].first + tile, strip_end);
+						const uint32_t b_end = std::min(tasks[task].second + tile, block_end);
+						uint32_t table[18];
+
+						for (uint32_t a = tasks[task].first; a < a_end; ++a)
+						{
+							const uint64_t* pa = &strip_planes[static_cast<size_t>(a - strip_start) * kPlanes * plane_words];
+							const uint32_t* ca = &strip_counts[static_cast<size_t>(a - strip_start) * (kPlanes + 1)];
+
+							for (uint32_t b = tasks[task].second; b < std::min(b_end, a); ++b)
+							{
+								pairTable(pa, ca, &second_planes[static_cast<size_t>(b - block_start) * kPlanes * plane_words],
+									&second_counts[static_cast<size_t>(b - block_start) * (kPlanes + 1)], table);
+
+								if (ksaStatistic(table) < critical_value)
+									continue;
+
+								refitted[thread_index]++;
+
+								const double statistic = interactionStatistic(table);
+
+								if (statistic >= critical_value)
+									found[thread_index].push_back({ b, a, statistic, chiSquare4PValue(statistic) });
+							}
+						}
+					});
+			}
+		}
+
+		for (uint32_t thread = 0; thread < threads; ++thread)
+		{
+			results.insert(results.end(), found[thread].begin(), found[thread].end());
+			pairs_refitted += refitted[thread];
+		}
+
+		std::sort(results.begin(), results.end(), [](const EpistasisResult& x, const EpistasisResult& y)
+			{
+				return x.first != y.first ? x.first < y.first : x.second < y.second;
+			});
+
+		pairs_tested = static_cast<uint64_t>(variant_count) * (variant_count - (variant_count ? 1 : 0)) / 2;
+	}
+
+	// <prefix>.epi.cc: every pair with interaction p below report_p
+	void write(const std::string& prefix)
+	{
+		compute();
+
+		std::vector<VariantInfo> variants;
+		reader.readVariantInfo(variants);
+
+		std::ofstream out(prefix + ".epi.cc");
+
+		if (!out.is_open())
+			throw std::runtime_error("Failed to open " + prefix + ".epi.cc");
+
+		out << "#CHROM1\tID1\tCHROM2\tID2\tSTAT\tP\n";
+
+		for (const EpistasisResult& result : results)
+		{
+			out << variants[result.first].chrom << '\t' << variants[result.first].id << '\t'
+				<< variants[result.second].chrom << '\t' << variants[result.second].id << '\t'
+				<< result.statistic << '\t' << result.p << '\n';
+		}
+
+		if (!out)
+			throw std::runtime_error("Failed to write " + prefix + ".epi.cc");
+	}
+};
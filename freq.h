@@ -0,0 +1,108 @@
+#pragma once
+
+#include <fstream>
+#include <vector>
+#include <string>
+#include <stdexcept>
+#include <cstdint>
+#include <algorithm>
+
+#include "plink2_reader.h"
+#include "chrx.h"
+
+struct FreqOptions {
+	uint32_t block_variants = 65536;
+};
+
+// ALT allele frequencies. Autosomal counts come from the reader's
+// popcount/difflist counting; chromosome X rows are decoded and counted with
+// the sex masks, males haploid.
+class AlleleFrequencyEngine {
+private:
+	Plink2Reader& reader;
+	FreqOptions options;
+
+public:
+	std::vector<VariantInfo> variants;
+	std::vector<AlleleCounts> counts;
+
+	AlleleFrequencyEngine(Plink2Reader& reader, const FreqOptions& options)
+		: reader(reader), options(options)
+	{
+		if (options.block_variants == 0)
+			throw std::invalid_argument("Frequency block size must be nonzero");
+	}
+
+	void compute()
+	{
+		const uint32_t words = reader.packed_words;
+
+		reader.readVariantInfo(variants);
+		counts.resize(variants.size());
+
+		std::unique_ptr<SexMasks> masks;
+		std::vector<GenotypeCounts> block_counts;
+		std::vector<uint64_t> packed;
+
+		for (const auto& range : chromosomeRanges(variants))
+		{
+			const bool is_x = isChromosomeX(variants[range.first].chrom);
+
+			if (is_x && !masks)
+				masks.reset(new SexMasks(reader));
+
+			for (uint32_t start = range.first; start < range.second; start += options.block_variants)
+			{
+				const uint32_t end = std::min(start + options.block_variants, range.second);
+
+				if (is_x)
+				{
+					reader.readPackedVariants(packed, start, end);
+
+					for (uint32_t variant = start; variant < end; ++variant)
+						counts[variant] = countXAlleles(&packed[static_cast<size_t>(variant - start) * words], *masks, words);
+
+					continue;
+				}
+
+				reader.readVariantCounts(block_counts, start, end);
+
+				for (uint32_t variant = start; variant < end; ++variant)
+				{
+					const GenotypeCounts& c = block_counts[variant - start];
+					counts[variant] = { c.het + 2ULL * c.hom_alt, 2ULL * (c.hom_ref + c.het + c.hom_alt) };
+				}
+			}
+		}
+	}
+
+	// <prefix>.afreq: ALT frequency and allele observation count per variant
+	void write(const std::string& prefix)
+	{
+		compute();
+
+		std::ofstream out(prefix + ".afreq");
+
+		if (!out.is_open())
+			throw std::runtime_error("Failed to open " + prefix + ".afreq");
+
+		out << "#CHROM\tID\tREF\tALT\tALT_FREQS\tOBS_CT\n";
+
+		for (uint32_t variant = 0; variant < variants.size(); ++variant)
+		{
+			const VariantInfo& info = variants[variant];
+
+			out << info.chrom << '\t' << info.id << '\t' << info.ref << '\t' << info.alt << '\t';
+
+			if (counts[variant].observed)
+				out << static_cast<double>(counts[variant].alt) / counts[variant].observed;
+			else
+				out << "NA";
+
+			out << '\t' << counts[variant].observed << '\n';
+		}
+
+		if (!out)
+			throw std::runtime_error("Failed to write " + prefix + ".afreq");
+	}
+};
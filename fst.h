@@ -0,0 +1,356 @@
+#pragma once
+
+#include <fstream>
+#include <vector>
+#include <string>
+#include <map>
+#include <stdexcept>
+#include <cstdint>
+#include <algorithm>
+
+#include "plink2_reader.h"
+#include "parallel.h"
+#include "case_control.h"
+#include "chrx.h"
+
+// Sample groups from a .psam column: one group per distinct value in order
+// of first appearance, samples with an empty, NA or -9 value in none. Each
+// group is a field mask over packed rows (bit 0 of a sample's 2-bit field),
+// with male and diploid halves for chromosome X.
+struct SampleGroups {
+	std::vector<std::string> names;
+	std::vector<uint32_t> sizes;
+	std::vector<std::vector<uint64_t>> masks;
+
+	SampleGroups(Plink2Reader& reader, const std::string& column)
+	{
+		std::vector<std::string> values;
+		std::map<std::string, uint32_t> index;
+
+		reader.readSampleColumn(column, values);
+
+		for (uint32_t sample = 0; sample < values.size(); ++sample)
+		{
+			const std::string& value = values[sample];
+
+			if (value.empty() || value == "NA" || value == "-9")
+				continue;
+
+			auto inserted = index.emplace(value, static_cast<uint32_t>(names.size()));
+
+			if (inserted.second)
+			{
+				names.push_back(value);
+				sizes.push_back(0);
+				masks.emplace_back(reader.packed_words, 0);
+			}
+
+			const uint32_t group = inserted.first->second;
+
+			masks[group][sample / kGenotypesPerWord] |= 1ULL << (2 * (sample % kGenotypesPerWord));
+			sizes[group]++;
+		}
+
+		if (names.empty())
+			throw std::runtime_error("No sample has a group in column " + column);
+	}
+
+	uint32_t count() const
+	{
+		return static_cast<uint32_t>(names.size());
+	}
+};
+
+struct FstOptions {
+	uint32_t block_variants = 4096;
+	uint32_t thread_count = 1;
+};
+
+// Site frequency spectra of every group and Hudson Fst of every pair of
+// groups, in one pass over the genotypes. Each decoded row is counted per
+// group by masked popcounts; the ALT count and allele observations of every
+// group then feed the spectra and the pairwise Fst sums. Variants are split
+// into fixed tasks run in parallel; the Fst sums of each task are added in
+// task order so the result does not depend on the thread count.
+//
+// The spectrum of a group counts, over the variants with no missing call in
+// the group, how many carry each number of ALT alleles. Fst is Hudson's
+// estimator as a ratio of averages (Bhatia et al. 2013): with p the ALT
+// frequencies and n the allele observations of the two groups,
+//   N = (p1 - p2)^2 - p1 (1 - p1) / (n1 - 1) - p2 (1 - p2) / (n2 - 1)
+//   D = p1 (1 - p2) + p2 (1 - p1)
+// summed over the variants observed in both, Fst = sum N / sum D. On
+// chromosome X males are haploid and their hets count as missing.
+class GroupFstEngine {
+private:
+	Plink2Reader& reader;
+	FstOptions options;
+	SampleGroups groups;
+
+	// Group masks restricted to males and to diploid samples, built on the first X variant
+	std::vector<std::vector<uint64_t>> male_masks;
+	std::vector<std::vector<uint64_t>> diploid_masks;
+	std::vector<uint32_t> male_sizes;
+
+	static constexpr uint32_t task_variants = 256;
+
+	// Fst sums of one task; spectra are integer counts and go to per-thread partials
+	struct FstPartial {
+		std::vector<double> numerator;
+		std::vector<double> denominator;
+		std::vector<uint32_t> used;
+	};
+
+	void buildSexMasks()
+	{
+		const SexMasks sex(reader);
+
+		male_masks.assign(groups.count(), std::vector<uint64_t>(reader.packed_words));
+		diploid_masks.assign(groups.count(), std::vector<uint64_t>(reader.packed_words));
+		male_sizes.assign(groups.count(), 0);
+
+		for (uint32_t group = 0; group < groups.count(); ++group)
+		{
+			for (uint32_t word = 0; word < reader.packed_words; ++word)
+			{
+				male_masks[group][word] = groups.masks[group][word] & sex.male[word];
+				diploid_masks[group][word] = groups.masks[group][word] & sex.diploid[word];
+				male_sizes[group] += popcount64(male_masks[group][word]);
+			}
+		}
+	}
+
+	// ALT copies, allele observations and missing calls of one row in one group
+	void countGroup(const uint64_t* row, uint32_t group, bool is_x, uint32_t& alt, uint32_t& observed, uint32_t& missing) const
+	{
+		const uint32_t words = reader.packed_words;
+		uint32_t het, hom_alt;
+
+		if (!is_x)
+		{
+			countStratum(row, groups.masks[group].data(), words, het, hom_alt, missing);
+			alt = het + 2 * hom_alt;
+			observed = 2 * (groups.sizes[group] - missing);
+			return;
+		}
+
+		uint32_t male_het, male_alt, male_missing;
+
+		countStratum(row, diploid_masks[group].data(), words, het, hom_alt, missing);
+		countStratum(row, male_masks[group].data(), words, male_het, male_alt, male_missing);
+
+		alt = het + 2 * hom_alt + male_alt;
+		observed = 2 * (groups.sizes[group] - male_sizes[group] - missing) + (male_sizes[group] - male_het - male_missing);
+		missing += male_het + male_missing;
+	}
+
+	uint32_t pairIndex(uint32_t first, uint32_t second) const
+	{
+		return second * (second - 1) / 2 + first;
+	}
+
+public:
+	// spectra[group][k]: variants with k ALT alleles among the group, fully called
+	std::vector<std::vector<uint64_t>> spectra;
+	std::vector<uint32_t> complete_variants;
+
+	// Per pair (first < second, at pairIndex): Hudson sums and variants used
+	std::vector<double> numerators;
+	std::vector<double> denominators;
+	std::vector<uint32_t> pair_variants;
+
+	GroupFstEngine(Plink2Reader& reader, const std::string& column, const FstOptions& options)
+		: reader(reader), options(options), groups(reader, column)
+	{
+		if (options.block_variants == 0)
+			throw std::invalid_argument("Fst block size must be nonzero");
+	}
+
+	const SampleGroups& sampleGroups() const
+	{
+		return groups;
+	}
+
+	void compute()
+	{
+		const uint32_t group_count = groups.count();
+		const uint32_t pair_count = group_count * (group_count - 1) / 2;
+		const uint32_t words = reader.packed_words;
+
+		// Spectrum of group g at offsets[g] .. offsets[g] + max ALT count
+		std::vector<uint32_t> offsets(group_count + 1, 0);
+
+		for (uint32_t group = 0; group < group_count; ++group)
+			offsets[group + 1] = offsets[group] + 2 * groups.sizes[group] + 1;
+
+		const uint32_t threads = std::max(1u, options.thread_count);
+		const FstPartial empty = { std::vector<double>(pair_count, 0.0), std::vector<double>(pair_count, 0.0), std::vector<uint32_t>(pair_count, 0) };
+
+		FstPartial total = empty;
+		std::vector<FstPartial> partials;
+		std::vector<std::vector<uint64_t>> thread_spectra(threads, std::vector<uint64_t>(offsets.back(), 0));
+		std::vector<std::vector<uint32_t>> thread_complete(threads, std::vector<uint32_t>(group_count, 0));
+
+		std::vector<VariantInfo> variants;
+		std::vector<uint64_t> packed;
+
+		reader.readVariantInfo(variants);
+
+		for (const auto& range : chromosomeRanges(variants))
+		{
+			const bool is_x = isChromosomeX(variants[range.first].chrom);
+
+			if (is_x && male_masks.empty())
+				buildSexMasks();
+
+			for (uint32_t start = range.first; start < range.second; start += options.block_variants)
+			{
+				const uint32_t end = std::min(start + options.block_variants, range.second);
+				const uint32_t tasks = (end - start + task_variants - 1) / task_variants;
+
+				reader.readPackedVariants(packed, start, end);
+				partials.assign(tasks, empty);
+
+				parallelFor(tasks, threads,
+					[&](uint32_t task, uint32_t thread_index)
+					{
+						FstPartial& partial = partials[task];
+						std::vector<uint64_t>& spectrum = thread_spectra[thread_index];
+						std::vector<uint32_t>& complete = thread_complete[thread_index];
+						const uint32_t task_start = start + task * task_variants;
+						const uint32_t task_end = std::min(task_start + task_variants, end);
+						std::vector<uint32_t> alt(group_count), observed(group_count);
+
+						for (uint32_t variant = task_start; variant < task_end; ++variant)
+						{
+							const uint64_t* row = &packed[static_cast<size_t>(variant - start) * words];
+
+							for (uint32_t group = 0; group < group_count; ++group)
+							{
+								uint32_t missing;
+
+								countGroup(row, group, is_x, alt[group], observed[group], missing);
+
+								if (!missing)
+								{
+									spectrum[offsets[group] + alt[group]]++;
+									complete[group]++;
+								}
+							}
+
+							for (uint32_t second = 1; second < group_count; ++second)
+							{
+								if (observed[second] < 2)
+									continue;
+
+								const double p2 = static_cast<double>(alt[second]) / observed[second];
+
+								for (uint32_t first = 0; first < second; ++first)
+								{
+									if (observed[first] < 2)
+										continue;
+
+									const double p1 = static_cast<double>(alt[first]) / observed[first];
+									const uint32_t pair = pairIndex(first, second);
+
+									partial.numerator[pair] += (p1 - p2) * (p1 - p2) - p1 * (1.0 - p1) / (observed[first] - 1.0)
+										- p2 * (1.0 - p2) / (observed[second] - 1.0);
+									partial.denominator[pair] += p1 * (1.0 - p2) + p2 * (1.0 - p1);
+									partial.used[pair]++;
+								}
+							}
+						}
+					});
+
+				for (const FstPartial& partial : partials)
+				{
+					for (uint32_t pair = 0; pair < pair_count; ++pair)
+					{
+						total.numerator[pair] += partial.numerator[pair];
+						total.denominator[pair] += partial.denominator[pair];
+						total.used[pair] += partial.used[pair];
+					}
+				}
+			}
+		}
+
+		spectra.assign(group_count, std::vector<uint64_t>());
+		complete_variants.assign(group_count, 0);
+
+		for (uint32_t group = 0; group < group_count; ++group)
+		{
+			spectra[group].assign(offsets[group + 1] - offsets[group], 0);
+
+			for (uint32_t thread = 0; thread < threads; ++thread)
+			{
+				for (uint32_t count = 0; count < spectra[group].size(); ++count)
+					spectra[group][count] += thread_spectra[thread][offsets[group] + count];
+
+				complete_variants[group] += thread_complete[thread][group];
+			}
+		}
+
+		numerators = total.numerator;
+		denominators = total.denominator;
+		pair_variants = total.used;
+	}
+
+	double fst(uint32_t first, uint32_t second) const
+	{
+		const uint32_t pair = pairIndex(std::min(first, second), std::max(first, second));
+		return numerators[pair] / denominators[pair];
+	}
+
+	// <prefix>.<name>.sfs: per group and ALT allele count, the fully called
+	// variants with that count; <prefix>.<name>.fst.summary: Hudson Fst of
+	// every pair of groups and the variants it is averaged over
+	void write(const std::string& prefix, const std::string& name)
+	{
+		compute();
+
+		const std::string sfs_path = prefix + "." + name + ".sfs";
+		std::ofstream sfs(sfs_path);
+
+		if (!sfs.is_open())
+			throw std::runtime_error("Failed to open " + sfs_path);
+
+		sfs << "#GROUP\tSAMPLES\tALT_CT\tVARIANTS\n";
+
+		for (uint32_t group = 0; group < groups.count(); ++group)
+		{
+			for (uint32_t count = 0; count < spectra[group].size(); ++count)
+				sfs << groups.names[group] << '\t' << groups.sizes[group] << '\t' << count << '\t' << spectra[group][count] << '\n';
+		}
+
+		if (!sfs)
+			throw std::runtime_error("Failed to write " + sfs_path);
+
+		const std::string fst_path = prefix + "." + name + ".fst.summary";
+		std::ofstream out(fst_path);
+
+		if (!out.is_open())
+			throw std::runtime_error("Failed to open " + fst_path);
+
+		out << "#POP1\tPOP2\tHUDSON_FST\tOBS_CT\n";
+
+		for (uint32_t first = 0; first < groups.count(); ++first)
+		{
+			for (uint32_t second = first + 1; second < groups.count(); ++second)
+			{
+				const uint32_t pair = pairIndex(first, second);
+
+				out << groups.names[first] << '\t' << groups.names[second] << '\t';
+
+				if (denominators[pair] > 0.0)
+					out << fst(first, second);
+				else
+					out << "NA";
+
+				out << '\t' << pair_variants[pair] << '\n';
+			}
+		}
+
+		if (!out)
+			throw std::runtime_error("Failed to write " + fst_path);
+	}
+};
@@ -0,0 +1,223 @@
+#pragma once
+
+#include <fstream>
+#include <vector>
+#include <string>
+#include <stdexcept>
+#include <cstdint>
+#include <cmath>
+#include <algorithm>
+
+#include "plink2_reader.h"
+#include "parallel.h"
+
+struct GrmOptions {
+	uint32_t block_variants = 256;
+	uint32_t sample_tile = 64;
+	uint32_t thread_count = 1;
+	double min_maf = 0.0;
+};
+
+// Genomic relationship matrix
+//   A[j][k] = 1/M * sum_i (x_ij - 2p_i)(x_ik - 2p_i) / (2p_i(1 - p_i))
+// accumulated block by block as Z^T Z, Z being the standardized genotypes of a
+// variant block (missing calls mean-imputed to 0). Only the lower triangle is
+// kept, row-major, matching the GCTA .grm.bin layout.
+class GrmEngine {
+private:
+	Plink2Reader& reader;
+	GrmOptions options;
+
+	std::vector<double> grm;
+	std::vector<float> standardized;
+
+	static size_t triangleIndex(uint32_t j, uint32_t k)
+	{
+		return static_cast<size_t>(j) * (j + 1) / 2 + k;
+	}
+
+	// Standardized values are grouped into per-tile panels of
+	// variant_count x sample_tile floats
+	size_t panelIndex(uint32_t sample, uint32_t variant, uint32_t variant_count) const
+	{
+		const uint32_t tile = options.sample_tile;
+		return (static_cast<size_t>(sample / tile) * variant_count + variant) * tile + sample % tile;
+	}
+
+	// Write one variant's standardized genotypes into the tile panels
+	void standardizeVariant(const uint64_t* packed, const GenotypeCounts& counts, uint32_t variant, uint32_t variant_count)
+	{
+		double standardized_values[4];
+		standardizedGenotypeValues(counts, standardized_values);
+
+		const float values[4] = {
+			static_cast<float>(standardized_values[0]),
+			static_cast<float>(standardized_values[1]),
+			static_cast<float>(standardized_values[2]),
+			static_cast<float>(standardized_values[3])
+		};
+
+		for (uint32_t word = 0; word < reader.packed_words; ++word)
+		{
+			uint64_t fields = packed[word];
+			const uint32_t first = word * kGenotypesPerWord;
+			const uint32_t last = std::min(first + kGenotypesPerWord, reader.sample_count);
+
+			for (uint32_t sample = first; sample < last; ++sample, fields >>= 2)
+				standardized[panelIndex(sample, variant, variant_count)] = values[fields & 3];
+		}
+	}
+
+	// SYRK micro-kernel for one tile pair: G[j][k] += sum_v Z[v][j] * Z[v][k]
+	// for j in tile tj, k in tile tk (k <= j). Z is stored as one panel per
+	// sample tile, variant-major within the panel, so both operands stream
+	// sequentially and the inner loop is a broadcast-multiply-add across k.
+	void accumulateTile(uint32_t variant_count, uint32_t tj, uint32_t tk)
+	{
+		const uint32_t tile = options.sample_tile;
+		const uint32_t j0 = tj * tile;
+		const uint32_t j1 = std::min(j0 + tile, reader.sample_count);
+		const uint32_t k0 = tk * tile;
+		const uint32_t k1 = std::min(k0 + tile, reader.sample_count);
+
+		const float* panel_j = &standardized[static_cast<size_t>(tj) * tile * variant_count];
+		const float* panel_k = &standardized[static_cast<size_t>(tk) * tile * variant_count];
+
+		const uint32_t kernel_rows = 4;
+		const uint32_t kernel_cols = 16;
+
+		for (uint32_t j = j0; j < j1; j += kernel_rows)
+		{
+			const uint32_t rows = std::min(kernel_rows, j1 - j);
+
+			for (uint32_t k = k0; k < std::min(k1, j + rows); k += kernel_cols)
+			{
+				const uint32_t cols = std::min(kernel_cols, k1 - k);
+				const float* a = panel_j + (j - j0);
+				const float* b = panel_k + (k - k0);
+				float acc[kernel_rows][kernel_cols] = {};
+
+				// Panels are zero-padded to whole tiles, so the full kernel is
+				// safe at the edges; the extra products are simply dropped
+				for (uint32_t v = 0; v < variant_count; ++v, a += tile, b += tile)
+				{
+					for (uint32_t r = 0; r < kernel_rows; ++r)
+					{
+						const float scale = a[r];
+
+						for (uint32_t c = 0; c < kernel_cols; ++c)
+							acc[r][c] += scale * b[c];
+					}
+				}
+
+				for (uint32_t r = 0; r < rows; ++r)
+				{
+					const uint32_t last = std::min(k + cols, j + r + 1);
+
+					for (uint32_t col = k; col < last; ++col)
+						grm[triangleIndex(j + r, col)] += acc[r][col - k];
+				}
+			}
+		}
+	}
+
+public:
+	uint32_t variants_used;
+
+	GrmEngine(Plink2Reader& reader, const GrmOptions& options)
+		: reader(reader), options(options), variants_used(0)
+	{
+		if (options.block_variants == 0 || options.sample_tile == 0 || options.sample_tile % 16 != 0)
+			throw std::invalid_argument("GRM block size must be nonzero and sample tile a multiple of 16");
+	}
+
+	void compute()
+	{
+		const uint32_t sample_count = reader.sample_count;
+		const uint32_t tile = options.sample_tile;
+		const uint32_t tile_count = (sample_count + tile - 1) / tile;
+		const uint32_t pair_count = tile_count * (tile_count + 1) / 2;
+
+		grm.assign(triangleIndex(sample_count, 0), 0.0);
+		variants_used = 0;
+
+		VariantFilter filter;
+		filter.min_maf = options.min_maf;
+		filter.skip_monomorphic = true;
+
+		std::vector<uint64_t> packed;
+		std::vector<uint32_t> kept;
+
+		for (uint32_t block_start = 0; block_start < reader.variant_count; block_start += options.block_variants)
+		{
+			const uint32_t block_end = std::min(block_start + options.block_variants, reader.variant_count);
+
+			reader.readFilteredVariants(packed, kept, block_start, block_end, filter);
+
+			const uint32_t kept_count = static_cast<uint32_t>(kept.size());
+
+			if (!kept_count)
+				continue;
+
+			// Samples past the end of the last tile stay zero
+			standardized.assign(static_cast<size_t>(tile_count) * tile * kept_count, 0.0f);
+
+			for (uint32_t v = 0; v < kept_count; ++v)
+			{
+				const uint64_t* row = &packed[static_cast<size_t>(v) * reader.packed_words];
+				standardizeVariant(row, countPackedGenotypes(row, reader.packed_words, sample_count), v, kept_count);
+			}
+
+			// Lower-triangle tile pairs write disjoint parts of the GRM
+			parallelFor(pair_count, options.thread_count,
+				[&](uint32_t pair, uint32_t)
+				{
+					uint32_t tj, tk;
+					lowerTrianglePair(pair, tj, tk);
+
+					accumulateTile(kept_count, tj, tk);
+				});
+
+			variants_used += kept_count;
+		}
+
+		if (variants_used)
+		{
+			for (double& value : grm)
+				value /= variants_used;
+		}
+	}
+
+	double value(uint32_t j, uint32_t k) const
+	{
+		return j >= k ? grm[triangleIndex(j, k)] : grm[triangleIndex(k, j)];
+	}
+
+	// <prefix>.grm.bin (float lower triangle), <prefix>.grm.N.bin (variants per
+	// pair) and <prefix>.grm.id
+	void write(const std::string& prefix)
+	{
+		std::ofstream bin(prefix + ".grm.bin", std::ios::binary);
+		std::ofstream counts(prefix + ".grm.N.bin", std::ios::binary);
+
+		if (!bin.is_open() || !counts.is_open())
+			throw std::runtime_error("Failed to open GRM output files");
+
+		std::vector<float> buffer;
+		const float used = static_cast<float>(variants_used);
+
+		for (uint32_t j = 0; j < reader.sample_count; ++j)
+		{
+			buffer.assign(grm.begin() + triangleIndex(j, 0), grm.begin() + triangleIndex(j + 1, 0));
+			bin.write(reinterpret_cast<const char*>(buffer.data()), static_cast<std::streamsize>(buffer.size() * sizeof(float)));
+
+			buffer.assign(j + 1, used);
+			counts.write(reinterpret_cast<const char*>(buffer.data()), static_cast<std::streamsize>(buffer.size() * sizeof(float)));
+		}
+
+		if (!bin || !counts)
+			throw std::runtime_error("Failed to write GRM");
+
+		writeSampleIdFile(reader, prefix + ".grm.id");
+	}
+};
@@ -0,0 +1,137 @@
+#pragma once
+
+#include <fstream>
+#include <vector>
+#include <string>
+#include <stdexcept>
+#include <cstdint>
+#include <algorithm>
+
+#include "plink2_reader.h"
+#include "parallel.h"
+#include "statistics.h"
+#include "chrx.h"
+
+struct HweOptions {
+	uint32_t block_variants = 65536;
+	uint32_t thread_count = 1;
+	bool mid_p = false;
+};
+
+// Hardy-Weinberg exact test of every variant. Genotype counts come from the
+// reader's popcount/difflist counting without building dense genotypes, and
+// the p-values are then computed in parallel over variant ranges. Chromosome X
+// is tested on the diploid (non-male) samples only, counted through the sex
+// masks.
+class HardyWeinbergTest {
+private:
+	Plink2Reader& reader;
+	HweOptions options;
+
+public:
+	std::vector<VariantInfo> variants;
+	std::vector<GenotypeCounts> counts;
+	std::vector<double> p_values;
+
+	HardyWeinbergTest(Plink2Reader& reader, const HweOptions& options)
+		: reader(reader), options(options)
+	{
+		if (options.block_variants == 0)
+			throw std::invalid_argument("HWE block size must be nonzero");
+	}
+
+	void compute()
+	{
+		const uint32_t variant_count = reader.variant_count;
+		const uint32_t words = reader.packed_words;
+
+		std::unique_ptr<SexMasks> masks;
+		std::vector<GenotypeCounts> block;
+		std::vector<uint64_t> packed;
+
+		reader.readVariantInfo(variants);
+		counts.clear();
+		counts.reserve(variant_count);
+
+		for (const auto& range : chromosomeRanges(variants))
+		{
+			const bool is_x = isChromosomeX(variants[range.first].chrom);
+
+			if (is_x && !masks)
+				masks.reset(new SexMasks(reader));
+
+			for (uint32_t start = range.first; start < range.second; start += options.block_variants)
+			{
+				const uint32_t end = std::min(start + options.block_variants, range.second);
+
+				if (!is_x)
+				{
+					reader.readVariantCounts(block, start, end);
+					counts.insert(counts.end(), block.begin(), block.end());
+					continue;
+				}
+
+				reader.readPackedVariants(packed, start, end);
+
+				for (uint32_t variant = start; variant < end; ++variant)
+					counts.push_back(countMaskedGenotypes(&packed[static_cast<size_t>(variant - start) * words], masks->diploid.data(), words));
+			}
+		}
+
+		p_values.resize(variant_count);
+
+		const uint32_t task_variants = 4096;
+
+		parallelFor((variant_count + task_variants - 1) / task_variants, options.thread_count,
+			[&](uint32_t task, uint32_t)
+			{
+				const uint32_t end = std::min((task + 1) * task_variants, variant_count);
+
+				for (uint32_t variant = task * task_variants; variant < end; ++variant)
+				{
+					const GenotypeCounts& c = counts[variant];
+					p_values[variant] = hweExactPValue(c.het, c.hom_ref, c.hom_alt, options.mid_p);
+				}
+			});
+	}
+
+	uint32_t countBelow(double threshold) const
+	{
+		return static_cast<uint32_t>(std::count_if(p_values.begin(), p_values.end(), [&](double p) { return p < threshold; }));
+	}
+
+	// <prefix>.hardy: ALT (A1) and REF (AX) genotype counts, observed and
+	// expected het frequencies, and the exact p-value
+	void write(const std::string& prefix)
+	{
+		compute();
+
+		std::ofstream out(prefix + ".hardy");
+
+		if (!out.is_open())
+			throw std::runtime_error("Failed to open " + prefix + ".hardy");
+
+		out << "#CHROM\tID\tA1\tAX\tHOM_A1_CT\tHET_A1_CT\tTWO_AX_CT\tO(HET_A1)\tE(HET_A1)\tP\n";
+
+		for (uint32_t variant = 0; variant < variants.size(); ++variant)
+		{
+			const VariantInfo& info = variants[variant];
+			const GenotypeCounts& c = counts[variant];
+			const uint32_t called = c.hom_ref + c.het + c.hom_alt;
+			const double freq = altAlleleFrequency(c);
+
+			out << info.chrom << '\t' << info.id << '\t' << info.alt << '\t' << info.ref << '\t'
+				<< c.hom_alt << '\t' << c.het << '\t' << c.hom_ref << '\t';
+
+			if (called)
+				out << static_cast<double>(c.het) / called << '\t' << 2.0 * freq * (1.0 - freq);
+			else
+				out << "NA\tNA";
+
+			out << '\t' << p_values[variant] << '\n';
+		}
+
+		if (!out)
+			throw std::runtime_error("Failed to write " + prefix + ".hardy");
+	}
+};
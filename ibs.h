@@ -0,0 +1,189 @@
+#pragma once
+
+#include <fstream>
+#include <vector>
+#include <string>
+#include <stdexcept>
+#include <cstdint>
+#include <algorithm>
+
+#include "plink2_reader.h"
+#include "parallel.h"
+
+struct IbsOptions {
+	uint32_t block_variants = 4096;
+	uint32_t sample_tile = 64;
+	uint32_t thread_count = 1;
+};
+
+// Identity-by-state between every pair of samples, counted on sample-major bit
+// planes 64 variants per word. For a pair, with both calls present:
+//   allele distance += popcount(genotypes differ) + popcount(opposite homs)
+// (IBS1 contributes 1 and IBS0 contributes 2), and the observed count is
+// popcount(both called). Samples are tiled so a tile pair's planes stay in cache.
+class IbsEngine {
+private:
+	Plink2Reader& reader;
+	IbsOptions options;
+
+	// Lower triangle (with diagonal), row-major
+	std::vector<uint32_t> distance;
+	std::vector<uint32_t> observed;
+
+	// Per-sample bit planes of the current block, plane_words words per sample
+	std::vector<uint64_t> low;
+	std::vector<uint64_t> high;
+	std::vector<uint64_t> called;
+	uint32_t plane_words;
+
+	static size_t triangleIndex(uint32_t j, uint32_t k)
+	{
+		return static_cast<size_t>(j) * (j + 1) / 2 + k;
+	}
+
+	void buildPlanes(uint32_t block_start, uint32_t block_end)
+	{
+		const uint32_t sample_count = reader.sample_count;
+		const uint32_t variant_count = block_end - block_start;
+		const uint32_t row_words = packedWordCount(variant_count);
+
+		std::vector<uint64_t> sample_major;
+		reader.readSampleMajorVariants(sample_major, block_start, block_end);
+
+		plane_words = (variant_count + 63) / 64;
+		low.resize(static_cast<size_t>(sample_count) * plane_words);
+		high.resize(low.size());
+		called.resize(low.size());
+
+		for (uint32_t sample = 0; sample < sample_count; ++sample)
+		{
+			const size_t offset = static_cast<size_t>(sample) * plane_words;
+
+			splitBitPlanes(&sample_major[static_cast<size_t>(sample) * row_words], variant_count, &low[offset], &high[offset]);
+
+			for (uint32_t word = 0; word < plane_words; ++word)
+				called[offset + word] = ~(low[offset + word] & high[offset + word]);
+		}
+	}
+
+	void accumulateTile(uint32_t tj, uint32_t tk)
+	{
+		const uint32_t tile = options.sample_tile;
+		const uint32_t j1 = std::min((tj + 1) * tile, reader.sample_count);
+		const uint32_t k0 = tk * tile;
+		const uint32_t k1 = std::min(k0 + tile, reader.sample_count);
+
+		for (uint32_t j = tj * tile; j < j1; ++j)
+		{
+			const uint64_t* lj = &low[static_cast<size_t>(j) * plane_words];
+			const uint64_t* hj = &high[static_cast<size_t>(j) * plane_words];
+			const uint64_t* cj = &called[static_cast<size_t>(j) * plane_words];
+
+			for (uint32_t k = k0; k < std::min(k1, j + 1); ++k)
+			{
+				const uint64_t* lk = &low[static_cast<size_t>(k) * plane_words];
+				const uint64_t* hk = &high[static_cast<size_t>(k) * plane_words];
+				const uint64_t* ck = &called[static_cast<size_t>(k) * plane_words];
+
+				uint32_t pair_distance = 0;
+				uint32_t pair_observed = 0;
+
+				for (uint32_t word = 0; word < plane_words; ++word)
+				{
+					const uint64_t both = cj[word] & ck[word];
+					const uint64_t high_diff = hj[word] ^ hk[word];
+					const uint64_t differ = both & ((lj[word] ^ lk[word]) | high_diff);
+
+					// Called homs have a clear low bit; opposite homs differ in the high bit
+					const uint64_t opposite = ~(lj[word] | lk[word]) & high_diff;
+
+					pair_distance += popcount64(differ) + popcount64(opposite);
+					pair_observed += popcount64(both);
+				}
+
+				distance[triangleIndex(j, k)] += pair_distance;
+				observed[triangleIndex(j, k)] += pair_observed;
+			}
+		}
+	}
+
+	void writeTriangle(const std::string& path, bool similarity)
+	{
+		std::ofstream out(path, std::ios::binary);
+
+		if (!out.is_open())
+			throw std::runtime_error("Failed to open " + path);
+
+		std::vector<float> row;
+
+		for (uint32_t j = 0; j < reader.sample_count; ++j)
+		{
+			row.resize(j + 1);
+
+			for (uint32_t k = 0; k <= j; ++k)
+			{
+				const size_t index = triangleIndex(j, k);
+
+				if (!similarity)
+					row[k] = static_cast<float>(distance[index]);
+				else
+					row[k] = observed[index] ? static_cast<float>(1.0 - distance[index] / (2.0 * observed[index])) : 0.0f;
+			}
+
+			out.write(reinterpret_cast<const char*>(row.data()), static_cast<std::streamsize>(row.size() * sizeof(float)));
+		}
+
+		if (!out)
+			throw std::runtime_error("Failed to write " + path);
+	}
+
+public:
+	IbsEngine(Plink2Reader& reader, const IbsOptions& options)
+		: reader(reader), options(options), plane_words(0)
+	{
+		if (options.block_variants == 0 || options.sample_tile == 0)
+			throw std::invalid_argument("IBS block and tile sizes must be nonzero");
+	}
+
+	void compute()
+	{
+		const uint32_t sample_count = reader.sample_count;
+		const uint32_t tile = options.sample_tile;
+		const uint32_t tile_count = (sample_count + tile - 1) / tile;
+
+		distance.assign(triangleIndex(sample_count, 0), 0);
+		observed.assign(distance.size(), 0);
+
+		for (uint32_t block_start = 0; block_start < reader.variant_count; block_start += options.block_variants)
+		{
+			const uint32_t block_end = std::min(block_start + options.block_variants, reader.variant_count);
+
+			buildPlanes(block_start, block_end);
+
+			parallelFor(tile_count * (tile_count + 1) / 2, options.thread_count,
+				[&](uint32_t pair, uint32_t)
+				{
+					uint32_t tj, tk;
+					lowerTrianglePair(pair, tj, tk);
+
+					accumulateTile(tj, tk);
+				});
+		}
+	}
+
+	// Proportion of alleles shared IBS, 1 - distance / (2 * observed)
+	double similarity(uint32_t j, uint32_t k) const
+	{
+		const size_t index = j >= k ? triangleIndex(j, k) : triangleIndex(k, j);
+		return observed[index] ? 1.0 - distance[index] / (2.0 * observed[index]) : 0.0;
+	}
+
+	// <prefix>.mibs.bin (IBS similarity) and <prefix>.dist.bin (allele-count
+	// distance), float lower triangles with diagonal, plus <prefix>.mibs.id
+	void write(const std::string& prefix)
+	{
+		writeTriangle(prefix + ".mibs.bin", true);
+		writeTriangle(prefix + ".dist.bin", false);
+		writeSampleIdFile(reader, prefix + ".mibs.id");
+	}
+};
@@ -0,0 +1,271 @@
+#pragma once
+
+#include <fstream>
+#include <vector>
+#include <string>
+#include <stdexcept>
+#include <cstdint>
+#include <algorithm>
+#include <utility>
+
+#include "plink2_reader.h"
+#include "parallel.h"
+
+struct KingOptions {
+	uint32_t block_variants = 4096;
+	uint32_t sample_tile = 64;
+	uint32_t thread_count = 1;
+
+	// Bytes of per-pair counters held at once; bounds the row strip size
+	uint64_t memory_budget = 1ULL << 30;
+
+	// Only emit pairs with kinship above this (threshold mode), or every pair when unset
+	bool use_cutoff = false;
+	double cutoff = 0.0;
+};
+
+struct KingCounts {
+	uint32_t het_het;
+	uint32_t ibs0;
+	uint32_t het_j;
+	uint32_t het_k;
+	uint32_t called;
+};
+
+// KING-robust kinship for every sample pair j > k over jointly called variants,
+// by KING's between-family estimator (as plink2 --make-king):
+//   kinship = 1/2 - (4 * IBS0 + HET_j HOM_k + HET_k HOM_j) / (4 * min(HET_j, HET_k))
+// where HET_j HOM_k = HET_j - HETHET counts j het and k homozygous.
+// Counts come from popcounts over het / called / bit-plane words, 64 variants at
+// a time. Pairs are processed in row strips sized to the memory budget, each
+// strip one streaming pass over the file, so finished rows can be emitted (or
+// filtered against the cutoff) without ever holding N^2 counters.
+class KingEngine {
+private:
+	Plink2Reader& reader;
+	KingOptions options;
+
+	// Per-sample planes of the current block: hom alt, het and called
+	std::vector<uint64_t> hom_alt;
+	std::vector<uint64_t> het;
+	std::vector<uint64_t> called;
+	uint32_t plane_words;
+
+	// Counters of the current strip: rows [strip_start, strip_end), columns [0, row)
+	std::vector<KingCounts> counts;
+	uint32_t strip_start;
+
+	static uint64_t pairsBefore(uint32_t row)
+	{
+		return static_cast<uint64_t>(row) * (row - 1) / 2;
+	}
+
+	KingCounts& pairCounts(uint32_t j, uint32_t k)
+	{
+		return counts[pairsBefore(j) - pairsBefore(strip_start) + k];
+	}
+
+	void buildPlanes(uint32_t block_start, uint32_t block_end, uint32_t sample_end)
+	{
+		const uint32_t variant_count = block_end - block_start;
+		const uint32_t row_words = packedWordCount(variant_count);
+
+		std::vector<uint64_t> sample_major;
+		reader.readSampleMajorVariants(sample_major, block_start, block_end);
+
+		plane_words = (variant_count + 63) / 64;
+		hom_alt.resize(static_cast<size_t>(sample_end) * plane_words);
+		het.resize(hom_alt.size());
+		called.resize(hom_alt.size());
+
+		std::vector<uint64_t> low(plane_words);
+		std::vector<uint64_t> high(plane_words);
+
+		for (uint32_t sample = 0; sample < sample_end; ++sample)
+		{
+			const size_t offset = static_cast<size_t>(sample) * plane_words;
+
+			splitBitPlanes(&sample_major[static_cast<size_t>(sample) * row_words], variant_count, low.data(), high.data());
+
+			for (uint32_t word = 0; word < plane_words; ++word)
+			{
+				hom_alt[offset + word] = high[word] & ~low[word];
+				het[offset + word] = low[word] & ~high[word];
+				called[offset + word] = ~(low[word] & high[word]);
+			}
+		}
+	}
+
+	void accumulateTile(uint32_t tj, uint32_t tk, uint32_t strip_end)
+	{
+		const uint32_t tile = options.sample_tile;
+		const uint32_t j0 = std::max(tj * tile, strip_start);
+		const uint32_t j1 = std::min((tj + 1) * tile, strip_end);
+		const uint32_t k0 = tk * tile;
+		const uint32_t k1 = (tk + 1) * tile;
+
+		for (uint32_t j = j0; j < j1; ++j)
+		{
+			const uint64_t* alt_j = &hom_alt[static_cast<size_t>(j) * plane_words];
+			const uint64_t* het_j = &het[static_cast<size_t>(j) * plane_words];
+			const uint64_t* called_j = &called[static_cast<size_t>(j) * plane_words];
+
+			for (uint32_t k = k0; k < std::min(k1, j); ++k)
+			{
+				const uint64_t* alt_k = &hom_alt[static_cast<size_t>(k) * plane_words];
+				const uint64_t* het_k = &het[static_cast<size_t>(k) * plane_words];
+				const uint64_t* called_k = &called[static_cast<size_t>(k) * plane_words];
+
+				KingCounts& pair = pairCounts(j, k);
+
+				for (uint32_t word = 0; word < plane_words; ++word)
+				{
+					const uint64_t both = called_j[word] & called_k[word];
+
+					// Opposite homozygotes: both called, neither het, hom-alt status differs
+					const uint64_t hom_both = both & ~(het_j[word] | het_k[word]);
+
+					pair.het_het += popcount64(het_j[word] & het_k[word]);
+					pair.ibs0 += popcount64(hom_both & (alt_j[word] ^ alt_k[word]));
+					pair.het_j += popcount64(het_j[word] & called_k[word]);
+					pair.het_k += popcount64(het_k[word] & called_j[word]);
+					pair.called += popcount64(both);
+				}
+			}
+		}
+	}
+
+	void computeStrip(uint32_t strip_end)
+	{
+		const uint32_t tile = options.sample_tile;
+		counts.assign(pairsBefore(strip_end) - pairsBefore(strip_start), KingCounts{ 0, 0, 0, 0, 0 });
+
+		std::vector<std::pair<uint32_t, uint32_t>> tile_pairs;
+
+		for (uint32_t tj = strip_start / tile; tj * tile < strip_end; ++tj)
+		{
+			for (uint32_t tk = 0; tk <= tj; ++tk)
+				tile_pairs.emplace_back(tj, tk);
+		}
+
+		for (uint32_t block_start = 0; block_start < reader.variant_count; block_start += options.block_variants)
+		{
+			const uint32_t block_end = std::min(block_start + options.block_variants, reader.variant_count);
+
+			buildPlanes(block_start, block_end, strip_end);
+
+			parallelFor(static_cast<uint32_t>(tile_pairs.size()), options.thread_count,
+				[&](uint32_t task, uint32_t)
+				{
+					accumulateTile(tile_pairs[task].first, tile_pairs[task].second, strip_end);
+				});
+		}
+	}
+
+public:
+	KingEngine(Plink2Reader& reader, const KingOptions& options)
+		: reader(reader), options(options), plane_words(0), strip_start(0)
+	{
+		if (options.block_variants == 0 || options.sample_tile == 0)
+			throw std::invalid_argument("KING block and tile sizes must be nonzero");
+	}
+
+	static double kinship(const KingCounts& pair)
+	{
+		const uint32_t het_min = std::min(pair.het_j, pair.het_k);
+
+		if (!het_min)
+			return 0.0;
+
+		const uint32_t het_hom = (pair.het_j - pair.het_het) + (pair.het_k - pair.het_het);
+		return 0.5 - (4.0 * pair.ibs0 + het_hom) / (4.0 * het_min);
+	}
+
+	// Run strip by strip; on_row(j, counts of pairs (j, 0..j-1)) sees rows in order
+	template <typename RowFn>
+	void compute(RowFn on_row)
+	{
+		const uint32_t sample_count = reader.sample_count;
+		const uint32_t tile = options.sample_tile;
+		const uint64_t max_pairs = std::max<uint64_t>(options.memory_budget / sizeof(KingCounts), 1);
+
+		strip_start = 1;
+
+		while (strip_start < sample_count)
+		{
+			// Grow the strip tile by tile while its counters fit the budget
+			uint32_t strip_end = std::min(strip_start - strip_start % tile + tile, sample_count);
+
+			while (strip_end < sample_count && pairsBefore(std::min(strip_end + tile, sample_count)) - pairsBefore(strip_start) <= max_pairs)
+				strip_end = std::min(strip_end + tile, sample_count);
+
+			computeStrip(strip_end);
+
+			for (uint32_t j = strip_start; j < strip_end; ++j)
+				on_row(j, &pairCounts(j, 0));
+
+			strip_start = strip_end;
+		}
+	}
+
+	// Threshold mode writes <prefix>.kin0 with pairs above the cutoff; otherwise
+	// <prefix>.king.bin holds every kinship as a float lower triangle without
+	// the diagonal, with <prefix>.king.id
+	void write(const std::string& prefix)
+	{
+		std::vector<std::string> sample_ids;
+		const bool has_fid = readSampleLabels(reader, sample_ids);
+
+		if (options.use_cutoff)
+		{
+			std::ofstream out(prefix + ".kin0");
+
+			if (!out.is_open())
+				throw std::runtime_error("Failed to open " + prefix + ".kin0");
+
+			out << (has_fid ? "#FID1\tIID1\tFID2\tIID2" : "#IID1\tIID2") << "\tNSNP\tHETHET\tIBS0\tKINSHIP\n";
+
+			compute([&](uint32_t j, const KingCounts* row)
+				{
+					for (uint32_t k = 0; k < j; ++k)
+					{
+						const double value = kinship(row[k]);
+
+						if (value > options.cutoff)
+						{
+							out << sample_ids[j] << '\t' << sample_ids[k] << '\t' << row[k].called << '\t'
+								<< static_cast<double>(row[k].het_het) / std::max(row[k].called, 1u) << '\t'
+								<< static_cast<double>(row[k].ibs0) / std::max(row[k].called, 1u) << '\t' << value << '\n';
+						}
+					}
+				});
+
+			if (!out)
+				throw std::runtime_error("Failed to write " + prefix + ".kin0");
+		}
+		else
+		{
+			std::ofstream out(prefix + ".king.bin", std::ios::binary);
+
+			if (!out.is_open())
+				throw std::runtime_error("Failed to open " + prefix + ".king.bin");
+
+			std::vector<float> values;
+
+			compute([&](uint32_t j, const KingCounts* row)
+				{
+					values.resize(j);
+
+					for (uint32_t k = 0; k < j; ++k)
+						values[k] = static_cast<float>(kinship(row[k]));
+
+					out.write(reinterpret_cast<const char*>(values.data()), static_cast<std::streamsize>(values.size() * sizeof(float)));
+				});
+
+			if (!out)
+				throw std::runtime_error("Failed to write " + prefix + ".king.bin");
+
+			writeSampleIdFile(reader, prefix + ".king.id");
+		}
+	}
+};
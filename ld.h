@@ -0,0 +1,395 @@
+#pragma once
+
+#include <fstream>
+#include <vector>
+#include <string>
+#include <stdexcept>
+#include <cstdint>
+#include <cmath>
+#include <limits>
+#include <algorithm>
+#include <utility>
+
+#include "plink2_reader.h"
+#include "parallel.h"
+
+// Dosage sums of one variant over its called samples
+struct LdStats {
+	uint32_t called;
+	uint32_t sum;
+	uint32_t sum_sq;
+	bool has_missing;
+};
+
+// Split a packed row into the het, hom alt and missing bit planes used for LD
+// (64 samples per word, plane_words words each, back to back in planes);
+// low and high are plane_words of scratch
+inline LdStats buildLdPlanes(const uint64_t* row, uint32_t sample_count, uint64_t* planes, uint64_t* low, uint64_t* high)
+{
+	const uint32_t plane_words = (sample_count + 63) / 64;
+	const GenotypeCounts counts = countPackedGenotypes(row, packedWordCount(sample_count), sample_count);
+
+	splitBitPlanes(row, sample_count, low, high);
+
+	for (uint32_t word = 0; word < plane_words; ++word)
+	{
+		planes[word] = low[word] & ~high[word];
+		planes[plane_words + word] = high[word] & ~low[word];
+		planes[2 * plane_words + word] = low[word] & high[word];
+	}
+
+	return { sample_count - counts.missing, counts.het + 2 * counts.hom_alt, counts.het + 4 * counts.hom_alt, counts.missing != 0 };
+}
+
+// Minor allele frequency among called samples
+inline double ldMaf(const LdStats& stats)
+{
+	const double freq = stats.called ? stats.sum / (2.0 * stats.called) : 0.0;
+
+	return std::min(freq, 1.0 - freq);
+}
+
+// Squared dosage correlation over samples called in both variants; NaN when
+// either is constant there. Without missing calls on either side the
+// single-variant sums are reused and only the cross term is counted.
+inline double ldR2(const uint64_t* pa, const LdStats& sa, const uint64_t* pb, const LdStats& sb, uint32_t plane_words)
+{
+	const uint64_t* het_a = pa;
+	const uint64_t* alt_a = pa + plane_words;
+	const uint64_t* het_b = pb;
+	const uint64_t* alt_b = pb + plane_words;
+
+	uint64_t het_het = 0, het_alt = 0, alt_het = 0, alt_alt = 0;
+
+	for (uint32_t word = 0; word < plane_words; ++word)
+	{
+		het_het += popcount64(het_a[word] & het_b[word]);
+		het_alt += popcount64(het_a[word] & alt_b[word]);
+		alt_het += popcount64(alt_a[word] & het_b[word]);
+		alt_alt += popcount64(alt_a[word] & alt_b[word]);
+	}
+
+	double n, sum_a, sum_b, sq_a, sq_b;
+
+	if (!sa.has_missing && !sb.has_missing)
+	{
+		n = sa.called;
+		sum_a = sa.sum;
+		sum_b = sb.sum;
+		sq_a = sa.sum_sq;
+		sq_b = sb.sum_sq;
+	}
+	else
+	{
+		// Restrict each side's sums to samples the other side also called
+		const uint64_t* missing_a = pa + 2 * plane_words;
+		const uint64_t* missing_b = pb + 2 * plane_words;
+		uint64_t called = 0, ha = 0, aa = 0, hb = 0, ab = 0;
+
+		for (uint32_t word = 0; word < plane_words; ++word)
+		{
+			const uint64_t both = ~(missing_a[word] | missing_b[word]);
+
+			called += popcount64(both);
+			ha += popcount64(het_a[word] & both);
+			aa += popcount64(alt_a[word] & both);
+			hb += popcount64(het_b[word] & both);
+			ab += popcount64(alt_b[word] & both);
+		}
+
+		n = static_cast<double>(called);
+		sum_a = ha + 2.0 * aa;
+		sum_b = hb + 2.0 * ab;
+		sq_a = ha + 4.0 * aa;
+		sq_b = hb + 4.0 * ab;
+	}
+
+	const double cross = het_het + 2.0 * (het_alt + alt_het) + 4.0 * alt_alt;
+	const double covariance = n * cross - sum_a * sum_b;
+	const double variance_a = n * sq_a - sum_a * sum_a;
+	const double variance_b = n * sq_b - sum_b * sum_b;
+
+	if (variance_a <= 0 || variance_b <= 0)
+		return std::numeric_limits<double>::quiet_NaN();
+
+	return covariance / variance_a * covariance / variance_b;
+}
+
+// LD planes of a run of consecutive variants, kept in a ring of fixed
+// capacity so a sliding window holds O(window) decoded variants however long
+// the chromosome is
+class LdWindow {
+private:
+	Plink2Reader& reader;
+	uint32_t capacity;
+	uint32_t plane_words;
+
+	std::vector<uint64_t> planes;
+	std::vector<LdStats> stats;
+	std::vector<uint64_t> packed;
+	std::vector<uint64_t> low;
+	std::vector<uint64_t> high;
+
+	uint32_t first_variant;
+	uint32_t end_variant;
+
+	const uint64_t* planesOf(uint32_t variant) const
+	{
+		return &planes[static_cast<size_t>(variant % capacity) * 3 * plane_words];
+	}
+
+public:
+	LdWindow(Plink2Reader& reader, uint32_t capacity)
+		: reader(reader), capacity(std::max(capacity, 1u)), plane_words((reader.sample_count + 63) / 64),
+		planes(static_cast<size_t>(this->capacity) * 3 * plane_words), stats(this->capacity),
+		low(plane_words), high(plane_words), first_variant(0), end_variant(0)
+	{
+	}
+
+	// Hold [keep_from, end), decoding only variants not already held
+	void advance(uint32_t keep_from, uint32_t end)
+	{
+		if (keep_from < first_variant || keep_from > end_variant)
+			first_variant = end_variant = keep_from;
+		else
+			first_variant = keep_from;
+
+		if (end <= end_variant)
+			return;
+
+		if (end - first_variant > capacity)
+			throw std::logic_error("LD window exceeds its capacity");
+
+		const uint32_t words = reader.packed_words;
+		reader.readPackedVariants(packed, end_variant, end);
+
+		for (uint32_t variant = end_variant; variant < end; ++variant)
+		{
+			const uint32_t slot = variant % capacity;
+
+			stats[slot] = buildLdPlanes(&packed[static_cast<size_t>(variant - end_variant) * words], reader.sample_count,
+				&planes[static_cast<size_t>(slot) * 3 * plane_words], low.data(), high.data());
+		}
+
+		end_variant = end;
+	}
+
+	double maf(uint32_t variant) const
+	{
+		return ldMaf(stats[variant % capacity]);
+	}
+
+	double r2(uint32_t a, uint32_t b) const
+	{
+		return ldR2(planesOf(a), stats[a % capacity], planesOf(b), stats[b % capacity], plane_words);
+	}
+};
+
+// [begin, end) variant ranges of each chromosome, in file order
+inline std::vector<std::pair<uint32_t, uint32_t>> chromosomeRanges(const std::vector<VariantInfo>& variants)
+{
+	std::vector<std::pair<uint32_t, uint32_t>> ranges;
+
+	for (uint32_t variant = 0; variant < variants.size(); ++variant)
+	{
+		if (ranges.empty() || variants[variant].chrom != variants[ranges.back().first].chrom)
+			ranges.emplace_back(variant, variant);
+
+		ranges.back().second = variant + 1;
+	}
+
+	return ranges;
+}
+
+struct LdOptions {
+	// Variants per window; pairs more than window - 1 variants apart are never compared
+	uint32_t window_variants = 50;
+	uint32_t step = 5;
+	double r2_threshold = 0.5;
+	uint32_t thread_count = 1;
+};
+
+// r^2 between every pair of variants at most window_variants - 1 apart on the
+// same chromosome, keeping pairs with r^2 >= r2_threshold. Variants are
+// handled in chunks; a chunk's pairs are computed in parallel from one ring of
+// chunk + window decoded variants.
+class LdCalculator {
+private:
+	Plink2Reader& reader;
+	LdOptions options;
+
+	static constexpr uint32_t chunk_variants = 1024;
+
+public:
+	LdCalculator(Plink2Reader& reader, const LdOptions& options)
+		: reader(reader), options(options)
+	{
+		if (options.window_variants < 2)
+			throw std::invalid_argument("LD window must span at least two variants");
+	}
+
+	// on_pair(a, b, r2) in order of a, then b
+	template <typename PairFn>
+	void compute(const std::vector<VariantInfo>& variants, PairFn on_pair)
+	{
+		const uint32_t reach = options.window_variants - 1;
+
+		LdWindow window(reader, chunk_variants + reach);
+		std::vector<std::vector<std::pair<uint32_t, double>>> pairs(chunk_variants);
+
+		for (const auto& range : chromosomeRanges(variants))
+		{
+			for (uint32_t chunk_start = range.first; chunk_start < range.second; chunk_start += chunk_variants)
+			{
+				const uint32_t chunk_end = std::min(chunk_start + chunk_variants, range.second);
+
+				window.advance(chunk_start, std::min(chunk_end + reach, range.second));
+
+				parallelFor(chunk_end - chunk_start, options.thread_count,
+					[&](uint32_t offset, uint32_t)
+					{
+						const uint32_t a = chunk_start + offset;
+						const uint32_t last = std::min(a + reach, range.second - 1);
+
+						pairs[offset].clear();
+
+						for (uint32_t b = a + 1; b <= last; ++b)
+						{
+							const double value = window.r2(a, b);
+
+							if (value >= options.r2_threshold)
+								pairs[offset].emplace_back(b, value);
+						}
+					});
+
+				for (uint32_t a = chunk_start; a < chunk_end; ++a)
+				{
+					for (const auto& pair : pairs[a - chunk_start])
+						on_pair(a, pair.first, pair.second);
+				}
+			}
+		}
+	}
+
+	// <prefix>.vcor
+	void write(const std::string& prefix)
+	{
+		std::vector<VariantInfo> variants;
+		reader.readVariantInfo(variants);
+
+		std::ofstream out(prefix + ".vcor");
+
+		if (!out.is_open())
+			throw std::runtime_error("Failed to open " + prefix + ".vcor");
+
+		out << "#CHROM_A\tPOS_A\tID_A\tCHROM_B\tPOS_B\tID_B\tUNPHASED_R2\n";
+
+		compute(variants, [&](uint32_t a, uint32_t b, double r2)
+			{
+				const VariantInfo& va = variants[a];
+				const VariantInfo& vb = variants[b];
+
+				out << va.chrom << '\t' << va.pos << '\t' << va.id << '\t' << vb.chrom << '\t' << vb.pos << '\t' << vb.id << '\t' << r2 << '\n';
+			});
+
+		if (!out)
+			throw std::runtime_error("Failed to write " + prefix + ".vcor");
+	}
+};
+
+// indep-pairwise pruning: a window of window_variants slides along each
+// chromosome step variants at a time, and whenever two variants still in the
+// window have r^2 above r2_threshold the one with the lower MAF is removed.
+// A pair is only ever tested once, when its later variant enters the window,
+// since an earlier verdict cannot change. Chromosomes are pruned in parallel,
+// each with its own ring of window_variants decoded variants.
+class LdPruner {
+private:
+	Plink2Reader& reader;
+	LdOptions options;
+
+	void pruneChromosome(uint32_t begin, uint32_t end, std::vector<uint8_t>& removed)
+	{
+		LdWindow window(reader, options.window_variants);
+		uint32_t window_start = begin;
+		uint32_t tested_end = begin;
+
+		while (true)
+		{
+			const uint32_t window_end = std::min(window_start + options.window_variants, end);
+
+			window.advance(window_start, window_end);
+
+			for (uint32_t b = tested_end; b < window_end; ++b)
+			{
+				for (uint32_t a = window_start; a < b && !removed[b]; ++a)
+				{
+					if (removed[a] || !(window.r2(a, b) > options.r2_threshold))
+						continue;
+
+					if (window.maf(a) < window.maf(b))
+						removed[a] = 1;
+					else
+						removed[b] = 1;
+				}
+			}
+
+			tested_end = window_end;
+
+			if (window_end == end)
+				break;
+
+			window_start += options.step;
+		}
+	}
+
+public:
+	// One flag per variant, set when pruned
+	std::vector<uint8_t> removed;
+
+	LdPruner(Plink2Reader& reader, const LdOptions& options)
+		: reader(reader), options(options)
+	{
+		if (options.window_variants < 2 || options.step == 0 || options.step > options.window_variants)
+			throw std::invalid_argument("Pruning needs a window of at least two variants and a step within it");
+	}
+
+	void compute(const std::vector<VariantInfo>& variants)
+	{
+		const std::vector<std::pair<uint32_t, uint32_t>> ranges = chromosomeRanges(variants);
+
+		removed.assign(variants.size(), 0);
+
+		parallelFor(static_cast<uint32_t>(ranges.size()), options.thread_count,
+			[&](uint32_t chromosome, uint32_t)
+			{
+				pruneChromosome(ranges[chromosome].first, ranges[chromosome].second, removed);
+			});
+	}
+
+	// <prefix>.prune.in and <prefix>.prune.out, one variant ID per line
+	void write(const std::string& prefix)
+	{
+		std::vector<VariantInfo> variants;
+		reader.readVariantInfo(variants);
+
+		compute(variants);
+
+		std::ofstream kept(prefix + ".prune.in");
+		std::ofstream pruned(prefix + ".prune.out");
+
+		if (!kept.is_open() || !pruned.is_open())
+			throw std::runtime_error("Failed to open " + prefix + ".prune.in/.prune.out");
+
+		for (uint32_t variant = 0; variant < variants.size(); ++variant)
+			(removed[variant] ? pruned : kept) << variants[variant].id << '\n';
+
+		if (!kept || !pruned)
+			throw std::runtime_error("Failed to write " + prefix + ".prune.in/.prune.out");
+	}
+
+	uint32_t prunedCount() const
+	{
+		return static_cast<uint32_t>(std::count(removed.begin(), removed.end(), 1));
+	}
+};
@@ -0,0 +1,297 @@
+#pragma once
+
+#include <vector>
+#include <stdexcept>
+#include <cstdint>
+#include <cmath>
+#include <algorithm>
+#include <numeric>
+
+#ifdef __AVX__
+#include <immintrin.h>
+#endif
+
+// Small dense row-major matrix for the statistics engines. The large operands
+// (genotype blocks) never live here; only thin sample x k panels and k x k
+// systems do.
+struct Matrix {
+	uint32_t rows;
+	uint32_t cols;
+	std::vector<double> data;
+
+	Matrix() : rows(0), cols(0) {}
+	Matrix(uint32_t rows, uint32_t cols) : rows(rows), cols(cols), data(static_cast<size_t>(rows) * cols, 0.0) {}
+
+	double& operator()(uint32_t r, uint32_t c) { return data[static_cast<size_t>(r) * cols + c]; }
+	double operator()(uint32_t r, uint32_t c) const { return data[static_cast<size_t>(r) * cols + c]; }
+
+	double* row(uint32_t r) { return &data[static_cast<size_t>(r) * cols]; }
+	const double* row(uint32_t r) const { return &data[static_cast<size_t>(r) * cols]; }
+};
+
+// target[0, count) += source[0, count)
+inline void addToRow(double* target, const double* source, uint32_t count)
+{
+	uint32_t c = 0;
+
+#ifdef __AVX__
+	for (; c + 4 <= count; c += 4)
+		_mm256_storeu_pd(target + c, _mm256_add_pd(_mm256_loadu_pd(target + c), _mm256_loadu_pd(source + c)));
+#endif
+
+	for (; c < count; ++c)
+		target[c] += source[c];
+}
+
+// target[0, count) += scale * source[0, count)
+inline void addScaledRow(double* target, const double* source, double scale, uint32_t count)
+{
+	uint32_t c = 0;
+
+#ifdef __AVX__
+	const __m256d factor = _mm256_set1_pd(scale);
+
+	for (; c + 4 <= count; c += 4)
+		_mm256_storeu_pd(target + c, _mm256_add_pd(_mm256_loadu_pd(target + c), _mm256_mul_pd(factor, _mm256_loadu_pd(source + c))));
+#endif
+
+	for (; c < count; ++c)
+		target[c] += scale * source[c];
+}
+
+// a^T b for a (n x p) and b (n x q)
+inline Matrix multiplyTransposed(const Matrix& a, const Matrix& b)
+{
+	if (a.rows != b.rows)
+		throw std::invalid_argument("Matrix dimensions do not match");
+
+	Matrix result(a.cols, b.cols);
+
+	for (uint32_t n = 0; n < a.rows; ++n)
+	{
+		const double* ar = a.row(n);
+		const double* br = b.row(n);
+
+		for (uint32_t i = 0; i < a.cols; ++i)
+		{
+			double* out = result.row(i);
+
+			for (uint32_t j = 0; j < b.cols; ++j)
+				out[j] += ar[i] * br[j];
+		}
+	}
+
+	return result;
+}
+
+// a b for a (n x p) and b (p x q)
+inline Matrix multiply(const Matrix& a, const Matrix& b)
+{
+	if (a.cols != b.rows)
+		throw std::invalid_argument("Matrix dimensions do not match");
+
+	Matrix result(a.rows, b.cols);
+
+	for (uint32_t n = 0; n < a.rows; ++n)
+	{
+		double* out = result.row(n);
+
+		for (uint32_t i = 0; i < a.cols; ++i)
+		{
+			const double scale = a(n, i);
+			const double* br = b.row(i);
+
+			for (uint32_t j = 0; j < b.cols; ++j)
+				out[j] += scale * br[j];
+		}
+	}
+
+	return result;
+}
+
+// Orthonormalize the columns of a in place (modified Gram-Schmidt, two passes
+// for stability). Columns that collapse to zero are left zero.
+inline void orthonormalizeColumns(Matrix& a)
+{
+	for (uint32_t pass = 0; pass < 2; ++pass)
+	{
+		for (uint32_t j = 0; j < a.cols; ++j)
+		{
+			for (uint32_t i = 0; i < j; ++i)
+			{
+				double dot = 0.0;
+
+				for (uint32_t r = 0; r < a.rows; ++r)
+					dot += a(r, i) * a(r, j);
+
+				for (uint32_t r = 0; r < a.rows; ++r)
+					a(r, j) -= dot * a(r, i);
+			}
+
+			double norm = 0.0;
+
+			for (uint32_t r = 0; r < a.rows; ++r)
+				norm += a(r, j) * a(r, j);
+
+			norm = std::sqrt(norm);
+
+			for (uint32_t r = 0; r < a.rows; ++r)
+				a(r, j) = norm > 1e-300 ? a(r, j) / norm : 0.0;
+		}
+	}
+}
+
+// Eigendecomposition of a symmetric matrix by cyclic Jacobi rotations.
+// Eigenvalues are returned in descending order with matching columns of vectors.
+inline void symmetricEigen(const Matrix& input, std::vector<double>& values, Matrix& vectors)
+{
+	const uint32_t n = input.rows;
+
+	if (input.cols != n)
+		throw std::invalid_argument("Eigendecomposition needs a square matrix");
+
+	Matrix a = input;
+	Matrix v(n, n);
+
+	for (uint32_t i = 0; i < n; ++i)
+		v(i, i) = 1.0;
+
+	for (uint32_t sweep = 0; sweep < 100; ++sweep)
+	{
+		double off = 0.0;
+
+		for (uint32_t p = 0; p < n; ++p)
+		{
+			for (uint32_t q = p + 1; q < n; ++q)
+				off += a(p, q) * a(p, q);
+		}
+
+		if (off < 1e-30)
+			break;
+
+		for (uint32_t p = 0; p < n; ++p)
+		{
+			for (uint32_t q = p + 1; q < n; ++q)
+			{
+				if (std::fabs(a(p, q)) < 1e-300)
+					continue;
+
+				const double theta = (a(q, q) - a(p, p)) / (2.0 * a(p, q));
+				const double t = (theta >= 0 ? 1.0 : -1.0) / (std::fabs(theta) + std::sqrt(theta * theta + 1.0));
+				const double c = 1.0 / std::sqrt(t * t + 1.0);
+				const double s = t * c;
+
+				for (uint32_t k = 0; k < n; ++k)
+				{
+					const double akp = a(k, p);
+					const double akq = a(k, q);
+					a(k, p) = c * akp - s * akq;
+					a(k, q) = s * akp + c * akq;
+				}
+
+				for (uint32_t k = 0; k < n; ++k)
+				{
+					const double apk = a(p, k);
+					const double aqk = a(q, k);
+					a(p, k) = c * apk - s * aqk;
+					a(q, k) = s * apk + c * aqk;
+				}
+
+				for (uint32_t k = 0; k < n; ++k)
+				{
+					const double vkp = v(k, p);
+					const double vkq = v(k, q);
+					v(k, p) = c * vkp - s * vkq;
+					v(k, q) = s * vkp + c * vkq;
+				}
+			}
+		}
+	}
+
+	std::vector<uint32_t> order(n);
+	std::iota(order.begin(), order.end(), 0u);
+	std::sort(order.begin(), order.end(), [&](uint32_t x, uint32_t y) { return a(x, x) > a(y, y); });
+
+	values.resize(n);
+	vectors = Matrix(n, n);
+
+	for (uint32_t j = 0; j < n; ++j)
+	{
+		values[j] = a(order[j], order[j]);
+
+		for (uint32_t i = 0; i < n; ++i)
+			vectors(i, j) = v(i, order[j]);
+	}
+}
+
+// Invert a symmetric positive definite matrix in place through its Cholesky
+// factor; returns false (leaving a unspecified) when a is not positive definite
+inline bool invertPositiveDefinite(Matrix& a)
+{
+	const uint32_t n = a.rows;
+
+	if (a.cols != n)
+		throw std::invalid_argument("Inversion needs a square matrix");
+
+	// Lower Cholesky factor L in the lower triangle
+	for (uint32_t j = 0; j < n; ++j)
+	{
+		double diagonal = a(j, j);
+
+		for (uint32_t k = 0; k < j; ++k)
+			diagonal -= a(j, k) * a(j, k);
+
+		if (!(diagonal > 1e-12 * std::max(1.0, std::fabs(a(j, j)))))
+			return false;
+
+		a(j, j) = std::sqrt(diagonal);
+
+		for (uint32_t i = j + 1; i < n; ++i)
+		{
+			double value = a(i, j);
+
+			for (uint32_t k = 0; k < j; ++k)
+				value -= a(i, k) * a(j, k);
+
+			a(i, j) = value / a(j, j);
+		}
+	}
+
+	// L^-1 in the lower triangle
+	for (uint32_t j = 0; j < n; ++j)
+	{
+		a(j, j) = 1.0 / a(j, j);
+
+		for (uint32_t i = j + 1; i < n; ++i)
+		{
+			double value = 0.0;
+
+			for (uint32_t k = j; k < i; ++k)
+				value -= a(i, k) * a(k, j);
+
+			a(i, j) = value / a(i, i);
+		}
+	}
+
+	// a^-1 = L^-T L^-1, filled symmetrically
+	for (uint32_t i = 0; i < n; ++i)
+	{
+		for (uint32_t j = 0; j <= i; ++j)
+		{
+			double value = 0.0;
+
+			for (uint32_t k = i; k < n; ++k)
+				value += a(k, i) * a(k, j);
+
+			a(i, j) = value;
+		}
+	}
+
+	for (uint32_t i = 0; i < n; ++i)
+	{
+		for (uint32_t j = i + 1; j < n; ++j)
+			a(i, j) = a(j, i);
+	}
+
+	return true;
+}
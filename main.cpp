@@ -1,200 +1,605 @@
 #include <iostream>
-#include <fstream>
+#include <sstream>
 #include <vector>
 #include <string>
+#include <map>
 #include <stdexcept>
 #include <cstdint>
+#include <algorithm>
+
+#include "plink2_reader.h"
+#include "sample_major.h"
+#include "grm.h"
+#include "ibs.h"
+#include "king.h"
+#include "pca.h"
+#include "association.h"
+#include "prs.h"
+#include "ld.h"
+#include "clump.h"
+#include "hwe.h"
+#include "sample_qc.h"
+#include "chrx.h"
+#include "freq.h"
+#include "case_control.h"
+#include "permutation.h"
+#include "epistasis.h"
+#include "burden.h"
+#include "fst.h"
+#include "duplicates.h"
 using namespace std;
 
-class Plink2Reader {
-private:
-	std::ifstream pgen_file;
-	std::ifstream pvar_file;
-	std::ifstream psam_file;
-
-public:
-	uint32_t variant_count;
-	uint32_t sample_count;
-	uint64_t file_size;
-
-	Plink2Reader(
-		const std::string& pgen_path,
-		const std::string& pvar_path,
-		const std::string& psam_path)
+// plink2_reader [mode] [--name value | --flag]...
+// Every mode reads <pfile>.pgen/.pvar/.psam, with --pfile defaulting to "plink2"
+struct CommandLine {
+	std::string mode;
+	std::map<std::string, std::string> options;
+
+	CommandLine(int argc, char** argv)
 	{
-		// Open files
-		pgen_file.open(pgen_path, std::ios::binary);
-		pvar_file.open(pvar_path);
-		psam_file.open(psam_path);
+		for (int i = 1; i < argc; ++i)
+		{
+			const std::string arg = argv[i];
 
-		if (!pgen_file.is_open() || !pvar_file.is_open() || !psam_file.is_open())
-			throw std::runtime_error("Failed to open one or more PLINK2 files");
+			if (arg.compare(0, 2, "--") != 0)
+			{
+				if (!mode.empty())
+					throw std::invalid_argument("Unexpected argument " + arg);
+
+				mode = arg;
+				continue;
+			}
 
-		// Read header from pgen file
-		readHeader();
+			if (i + 1 < argc && std::string(argv[i + 1]).compare(0, 2, "--") != 0)
+				options[arg.substr(2)] = argv[++i];
+			else
+				options[arg.substr(2)] = "";
+		}
+	}
+
+	bool has(const std::string& name) const
+	{
+		return options.count(name) != 0;
 	}
 
-	~Plink2Reader() {
-		if (pgen_file.is_open()) pgen_file.close();
-		if (pvar_file.is_open()) pvar_file.close();
-		if (psam_file.is_open()) psam_file.close();
+	std::string get(const std::string& name, const std::string& default_value) const
+	{
+		auto it = options.find(name);
+		return it == options.end() ? default_value : it->second;
 	}
 
-private:
-	void readHeader()
+	std::string require(const std::string& name) const
 	{
-		// See: https://github.com/chrchang/plink-ng/blob/master/pgen_spec/pgen_spec.pdf
+		auto it = options.find(name);
 
-		// Read magic numbers (first 2 bytes should be 0x6c, 0x1b)
-		char magic[2];
-		pgen_file.read(magic, 2);
+		if (it == options.end() || it->second.empty())
+			throw std::invalid_argument("Missing required option --" + name);
 
-		if (magic[0] != 0x6c || magic[1] != 0x1b)
-			throw std::runtime_error("Invalid PGEN file format");
+		return it->second;
+	}
 
-		// Read mode byte
-		char storage_mode;
-		pgen_file.read(&storage_mode, 1);
+	uint32_t threads() const
+	{
+		return getUint("threads", defaultThreadCount());
+	}
 
-		if (storage_mode != 0x10)
-			throw std::runtime_error("Unsupported storage mode");
+	std::string out() const
+	{
+		return get("out", pfile());
+	}
 
-		// Read variant and sample counts
-		pgen_file.read(reinterpret_cast<char*>(&variant_count), 4);
-		pgen_file.read(reinterpret_cast<char*>(&sample_count), 4);
+	double getDouble(const std::string& name, double default_value) const
+	{
+		return has(name) ? std::stod(require(name)) : default_value;
+	}
 
-		// Get file size
-		pgen_file.seekg(0, std::ios::end);
-		file_size = pgen_file.tellg();
-		pgen_file.seekg(11); // Return to start of genotype data
+	uint32_t getUint(const std::string& name, uint32_t default_value) const
+	{
+		return has(name) ? static_cast<uint32_t>(std::stoul(require(name))) : default_value;
 	}
 
-public:
-	void readGenotypesChunk(std::vector<std::vector<int>>& genotypes, uint32_t start_variant, uint32_t end_variant, uint32_t start_sample, uint32_t end_sample)
+	std::string pfile() const
 	{
-		if (end_variant >= variant_count || end_sample >= sample_count)
-			throw std::out_of_range("Requested chunk is out of range");
+		return get("pfile", "plink2");
+	}
+};
 
-		uint32_t num_variants = end_variant - start_variant;
-		uint32_t num_samples = end_sample - start_sample;
+static uint32_t findSample(Plink2Reader& reader, const std::string& sample_id)
+{
+	std::vector<std::string> sample_ids;
+	reader.readSampleIds(sample_ids);
 
-		genotypes.resize(num_samples, std::vector<int>(num_variants));
+	auto it = std::find(sample_ids.begin(), sample_ids.end(), sample_id);
 
-		const uint64_t start_pos = 11 + (start_variant * sample_count + start_sample) / 4;
-		pgen_file.seekg(start_pos);
+	if (it == sample_ids.end())
+		throw std::invalid_argument("Sample " + sample_id + " not found in .psam");
 
-		const uint32_t bytes_to_read = (end_variant - start_variant) * (end_sample - start_sample);
+	return static_cast<uint32_t>(it - sample_ids.begin());
+}
 
-		vector<uint8_t> file_chunk(bytes_to_read);
-		pgen_file.read(reinterpret_cast<char*>(&file_chunk[0]), bytes_to_read);
+// Example usage
+static void runExample(Plink2Reader& reader)
+{
+	const uint32_t variant_count = reader.variant_count;
+	const uint32_t sample_count = reader.sample_count;
 
-		uint32_t file_chunk_index = 0;
+	cout << "Variant count " << variant_count << endl;
+	cout << "Sample count " << sample_count << endl;
 
-		for (uint32_t variant = start_variant; variant < end_variant; ++variant)
-		{
-			for (uint32_t sample = start_sample; sample < end_sample; ++sample)
-			{
-				int genotype = file_chunk[file_chunk_index] & 0x03; // Extract first genotype from byte
-				genotypes[sample - start_sample][variant - start_variant] = (genotype == 3) ? -1 : genotype; // -1 for missing
+	const uint32_t variant_chunk_size = 32;
+	const uint32_t sample_chunk_size = 64;
 
-				file_chunk_index++;
-			}
-		}
+	// Each variant chunk is read once and split into sample chunks in memory
+	Plink2TileIterator tiles(reader, variant_chunk_size, sample_chunk_size);
+	GenotypeTile tile;
 
-		//cout << "Bytes read:" << bytes_to_read << endl;
-		//cout << endl;
+	while (tiles.next(tile))
+	{
+		//cout << tile.genotypes.size() << endl;
 
+		//for (int i = 0; i < (int)tile.genotypes[0].size(); ++i)
+		//{
+		//	std::cout << tile.genotypes[0][i] << " ";
+		//}
+		//std::cout << "\n";
 	}
+}
 
-	void readVariantInfoChunk(std::vector<std::string>& variant_ids, uint32_t start_variant, uint32_t end_variant)
-	{
-		if (end_variant >= variant_count)
-			throw std::out_of_range("Requested chunk is out of range");
+// make-sample-major [--out file] [--memory MB]
+static void runMakeSampleMajor(Plink2Reader& reader, const CommandLine& cmd)
+{
+	const std::string out = cmd.get("out", cmd.pfile() + ".smaj");
+	const uint64_t memory = static_cast<uint64_t>(cmd.getUint("memory", 256)) << 20;
 
-		std::string line;
-		// Skip header line in .pvar
-		std::getline(pvar_file, line);
+	buildSampleMajorFile(reader, out, memory);
 
-		// Skip to the start variant
-		for (uint32_t i = 0; i < start_variant; ++i)
-			std::getline(pvar_file, line);
+	cout << "Wrote " << out << endl;
+}
 
-		// Read the chunk of variants
-		for (uint32_t i = start_variant; i < end_variant; ++i)
-		{
-			std::getline(pvar_file, line);
-			std::string id = line.substr(line.find('\t') + 1);
-			id = id.substr(0, id.find('\t'));
-			variant_ids.push_back(id);
-		}
-	}
+// sample-genotypes --sample IID [--smaj file]
+static void runSampleGenotypes(Plink2Reader& reader, const CommandLine& cmd)
+{
+	const uint32_t sample = findSample(reader, cmd.require("sample"));
+
+	SampleMajorReader sidecar(cmd.get("smaj", cmd.pfile() + ".smaj"));
+	sidecar.checkMatches(reader);
+
+	std::vector<int> genotypes;
+	sidecar.readSampleGenotypes(genotypes, sample);
 
-	void readSampleInfoChunk(std::vector<std::string>& sample_ids, uint32_t start_sample, uint32_t end_sample)
+	std::vector<VariantInfo> variants;
+	reader.readVariantInfo(variants);
+
+	for (uint32_t variant = 0; variant < reader.variant_count; ++variant)
+		cout << variants[variant].id << '\t' << genotypes[variant] << '\n';
+}
+
+// make-grm [--out prefix] [--maf x] [--threads N]
+static void runMakeGrm(Plink2Reader& reader, const CommandLine& cmd)
+{
+	GrmOptions options;
+	options.min_maf = cmd.getDouble("maf", 0.0);
+	options.thread_count = cmd.threads();
+
+	GrmEngine engine(reader, options);
+	engine.compute();
+	engine.write(cmd.out());
+
+	cout << "GRM from " << engine.variants_used << " variants written to " << cmd.out() << ".grm.bin" << endl;
+}
+
+// ibs [--out prefix] [--threads N]
+static void runIbs(Plink2Reader& reader, const CommandLine& cmd)
+{
+	IbsOptions options;
+	options.thread_count = cmd.threads();
+
+	IbsEngine engine(reader, options);
+	engine.compute();
+	engine.write(cmd.out());
+
+	cout << "IBS matrices written to " << cmd.out() << ".mibs.bin and " << cmd.out() << ".dist.bin" << endl;
+}
+
+// king [--cutoff x] [--memory MB] [--out prefix] [--threads N]
+static void runKing(Plink2Reader& reader, const CommandLine& cmd)
+{
+	KingOptions options;
+	options.thread_count = cmd.threads();
+	options.memory_budget = static_cast<uint64_t>(cmd.getUint("memory", 1024)) << 20;
+
+	if (cmd.has("cutoff"))
 	{
-		if (end_sample >= sample_count)
-			throw std::out_of_range("Requested chunk is out of range");
+		options.use_cutoff = true;
+		options.cutoff = cmd.getDouble("cutoff", 0.0);
+	}
 
-		std::string line;
-		// Skip header line in .psam
-		std::getline(psam_file, line);
+	KingEngine engine(reader, options);
+	engine.write(cmd.out());
 
-		// Skip to the start sample
-		for (uint32_t i = 0; i < start_sample; ++i)
-			std::getline(psam_file, line);
+	cout << "KING kinship written to " << cmd.out() << (options.use_cutoff ? ".kin0" : ".king.bin") << endl;
+}
 
-		// Read the chunk of samples
-		for (uint32_t i = start_sample; i < end_sample; ++i)
-		{
-			std::getline(psam_file, line);
-			std::string id = line.substr(0, line.find('\t'));
-			sample_ids.push_back(id);
-		}
+// pca [--pcs k] [--iterations q] [--maf x] [--seed n] [--out prefix] [--threads N]
+static void runPca(Plink2Reader& reader, const CommandLine& cmd)
+{
+	PcaOptions options;
+	options.pcs = cmd.getUint("pcs", options.pcs);
+	options.iterations = cmd.getUint("iterations", options.iterations);
+	options.min_maf = cmd.getDouble("maf", 0.0);
+	options.seed = cmd.getUint("seed", 1);
+	options.thread_count = cmd.threads();
+
+	PcaEngine engine(reader, options);
+	engine.compute();
+	engine.write(cmd.out());
+
+	cout << engine.eigenvalues.size() << " PCs from " << engine.variants_used << " variants written to " << cmd.out() << ".eigenvec" << endl;
+}
+
+// Covariates from --covar <file> (sample table such as a .eigenvec), or none
+static Matrix loadCovariates(Plink2Reader& reader, const CommandLine& cmd)
+{
+	Matrix covariates;
+	std::vector<std::string> names;
+
+	if (cmd.has("covar"))
+		readSampleTable(reader, cmd.require("covar"), covariates, names);
+
+	return covariates;
+}
+
+// linear [--pheno file | --pheno-name col] [--covar file] [--out prefix] [--threads N]
+// A --pheno sample table tests all of its columns in one pass over the genotypes
+static void runLinear(Plink2Reader& reader, const CommandLine& cmd)
+{
+	Matrix phenotypes;
+	std::vector<std::string> names;
+
+	if (cmd.has("pheno"))
+		readSampleTable(reader, cmd.require("pheno"), phenotypes, names);
+	else
+	{
+		names.push_back(cmd.get("pheno-name", "PHENO1"));
+		readPhenotypeColumn(reader, names[0], phenotypes);
 	}
-};
 
-// Example usage
-int main(void)
+	LinearOptions options;
+	options.thread_count = cmd.threads();
+
+	LinearAssociation engine(reader, phenotypes, loadCovariates(reader, cmd), options);
+	engine.write(cmd.out(), names);
+
+	cout << "Linear regression of " << names.size() << " phenotype(s) in " << engine.groupCount() << " missingness group(s) on "
+		<< engine.sampleCount() << " samples written to " << cmd.out() << ".<phenotype>.glm.linear" << endl;
+}
+
+// logistic [--pheno-name col] [--covar file] [--refit-p x] [--firth] [--out prefix] [--threads N]
+static void runLogistic(Plink2Reader& reader, const CommandLine& cmd)
 {
-	try
+	const std::string pheno_name = cmd.get("pheno-name", "PHENO1");
+
+	Matrix phenotype;
+	readPhenotypeColumn(reader, pheno_name, phenotype);
+	caseControlPhenotype(phenotype);
+
+	LogisticOptions options;
+	options.thread_count = cmd.threads();
+	options.refit_p = cmd.getDouble("refit-p", options.refit_p);
+	options.always_firth = cmd.has("firth");
+
+	LogisticAssociation engine(reader, phenotype, loadCovariates(reader, cmd), options);
+	engine.write(cmd.out(), pheno_name);
+
+	cout << "Logistic regression on " << engine.sampleCount() << " samples (" << engine.refit_count << " variants refitted, "
+		<< engine.firth_count << " with Firth) written to " << cmd.out() << "." << pheno_name << ".glm.logistic" << endl;
+}
+
+// score --score file[,file...] [--out prefix] [--threads N]
+static void runScore(Plink2Reader& reader, const CommandLine& cmd)
+{
+	ScoreOptions options;
+	options.thread_count = cmd.threads();
+
+	PolygenicScoreEngine engine(reader, options);
+
+	std::istringstream files(cmd.require("score"));
+
+	for (std::string path; std::getline(files, path, ','); )
+		engine.addScoreFile(path);
+
+	engine.compute();
+	engine.write(cmd.out());
+
+	for (uint32_t score = 0; score < engine.score_names.size(); ++score)
+		cout << engine.score_names[score] << ": " << engine.matched_counts[score] << " variants used, " << engine.skipped_counts[score] << " skipped" << endl;
+
+	cout << engine.score_names.size() << " scores over " << engine.variantsScored() << " variants written to " << cmd.out() << ".sscore" << endl;
+}
+
+// ld [--window variants] [--r2-min x] [--out prefix] [--threads N]
+static void runLd(Plink2Reader& reader, const CommandLine& cmd)
+{
+	LdOptions options;
+	options.window_variants = cmd.getUint("window", 10);
+	options.r2_threshold = cmd.getDouble("r2-min", 0.2);
+	options.thread_count = cmd.threads();
+
+	LdCalculator engine(reader, options);
+	engine.write(cmd.out());
+
+	cout << "LD pairs written to " << cmd.out() << ".vcor" << endl;
+}
+
+// indep-pairwise [--window variants] [--step variants] [--r2 x] [--out prefix] [--threads N]
+static void runIndepPairwise(Plink2Reader& reader, const CommandLine& cmd)
+{
+	LdOptions options;
+	options.window_variants = cmd.getUint("window", options.window_variants);
+	options.step = cmd.getUint("step", options.step);
+	options.r2_threshold = cmd.getDouble("r2", options.r2_threshold);
+	options.thread_count = cmd.threads();
+
+	LdPruner engine(reader, options);
+	engine.write(cmd.out());
+
+	cout << engine.prunedCount() << " of " << reader.variant_count << " variants pruned; lists written to "
+		<< cmd.out() << ".prune.in and " << cmd.out() << ".prune.out" << endl;
+}
+
+// clump --clump file [--clump-p1 x] [--clump-p2 x] [--clump-r2 x] [--clump-kb n] [--memory MB] [--out prefix] [--threads N]
+static void runClump(Plink2Reader& reader, const CommandLine& cmd)
+{
+	ClumpOptions options;
+	options.index_p = cmd.getDouble("clump-p1", options.index_p);
+	options.member_p = cmd.getDouble("clump-p2", options.member_p);
+	options.r2_threshold = cmd.getDouble("clump-r2", options.r2_threshold);
+	options.window_kb = cmd.getUint("clump-kb", options.window_kb);
+	options.thread_count = cmd.threads();
+
+	reader.enableBlockCache(static_cast<uint64_t>(cmd.getUint("memory", 256)) << 20);
+
+	LdClumper engine(reader, options, cmd.require("clump"));
+	engine.write(cmd.out());
+
+	const BlockCacheStats stats = reader.blockCacheStats();
+
+	cout << engine.clumps.size() << " clumps written to " << cmd.out() << ".clumps (block cache: "
+		<< stats.hits << " hits, " << stats.misses << " misses)" << endl;
+}
+
+// hardy [--hwe p] [--hwe-midp] [--out prefix] [--threads N]
+static void runHardy(Plink2Reader& reader, const CommandLine& cmd)
+{
+	HweOptions options;
+	options.mid_p = cmd.has("hwe-midp");
+	options.thread_count = cmd.threads();
+
+	HardyWeinbergTest engine(reader, options);
+	engine.write(cmd.out());
+
+	cout << "Hardy-Weinberg exact tests for " << reader.variant_count << " variants written to " << cmd.out() << ".hardy" << endl;
+
+	if (cmd.has("hwe"))
 	{
-		Plink2Reader reader("plink2.pgen", "plink2.pvar", "plink2.psam");
+		const double threshold = cmd.getDouble("hwe", 0.0);
+		cout << engine.countBelow(threshold) << " variants with p < " << threshold << endl;
+	}
+}
+
+// sample-qc [--out prefix] [--threads N]
+static void runSampleQc(Plink2Reader& reader, const CommandLine& cmd)
+{
+	SampleQcOptions options;
+	options.thread_count = cmd.threads();
 
-		const uint32_t variant_count = reader.variant_count;
-		const uint32_t sample_count = reader.sample_count;
+	SampleQcEngine engine(reader, options);
+	engine.write(cmd.out());
 
-		cout << "Variant count " << variant_count << endl;
-		cout << "Sample count " << sample_count << endl;
+	cout << "Per-sample QC for " << reader.sample_count << " samples written to " << cmd.out() << ".sqc" << endl;
+}
 
-		const uint32_t variant_chunk_size = 32;
-		const uint32_t sample_chunk_size = 64;
+// freq [--out prefix]
+static void runFreq(Plink2Reader& reader, const CommandLine& cmd)
+{
+	AlleleFrequencyEngine engine(reader, FreqOptions());
+	engine.write(cmd.out());
 
-		for (uint32_t i = 0; i < variant_count; i += variant_chunk_size)
-		{
-			uint32_t variant_end_chunk = i + variant_chunk_size;
+	cout << "Allele frequencies written to " << cmd.out() << ".afreq" << endl;
+}
 
-			if (variant_end_chunk >= variant_count)
-				variant_end_chunk = variant_count - 1;
+// check-sex [--female-max-f x] [--male-min-f x] [--out prefix] [--threads N]
+static void runCheckSex(Plink2Reader& reader, const CommandLine& cmd)
+{
+	SexCheckOptions options;
+	options.female_max_f = cmd.getDouble("female-max-f", options.female_max_f);
+	options.male_min_f = cmd.getDouble("male-min-f", options.male_min_f);
+	options.thread_count = cmd.threads();
 
-			for (uint32_t j = 0; j < sample_count; j += sample_chunk_size)
-			{
-				uint32_t sample_end_chunk = j + sample_chunk_size;
+	SexCheck engine(reader, options);
+	engine.write(cmd.out());
 
-				if (sample_end_chunk >= sample_count)
-					sample_end_chunk = sample_count - 1;
+	cout << engine.problemCount() << " problem samples from " << engine.x_variants << " X variants; written to "
+		<< cmd.out() << ".sexcheck" << endl;
+}
 
-				std::vector<std::vector<int>> genotypes;
-				reader.readGenotypesChunk(genotypes, i, variant_end_chunk, j, sample_end_chunk);
+// assoc [--pheno-name col] [--out prefix] [--threads N]
+static void runAssoc(Plink2Reader& reader, const CommandLine& cmd)
+{
+	const std::string pheno_name = cmd.get("pheno-name", "PHENO1");
 
-				//cout << genotypes.size() << endl;
+	Matrix phenotype;
+	readPhenotypeColumn(reader, pheno_name, phenotype);
+	caseControlPhenotype(phenotype);
 
-				//for (int i = 0; i < (int)genotypes[0].size(); ++i)
-				//{
-				//	std::cout << genotypes[0][i] << " ";
-				//}
-				//std::cout << "\n";
-			}
+	CaseControlOptions options;
+	options.thread_count = cmd.threads();
 
-		}
+	CaseControlAssociation engine(reader, phenotype, options);
+	engine.write(cmd.out(), pheno_name);
+
+	cout << "Allelic and genotypic tests on " << engine.caseCount() << " cases and " << engine.controlCount() << " controls written to "
+		<< cmd.out() << "." << pheno_name << ".assoc" << endl;
+}
+
+// assoc-perm [--pheno-name col] [--perms n] [--seed s] [--out prefix] [--threads N]
+static void runAssocPerm(Plink2Reader& reader, const CommandLine& cmd)
+{
+	const std::string pheno_name = cmd.get("pheno-name", "PHENO1");
+
+	Matrix phenotype;
+	readPhenotypeColumn(reader, pheno_name, phenotype);
+	caseControlPhenotype(phenotype);
+
+	PermutationOptions options;
+	options.permutations = cmd.getUint("perms", options.permutations);
+	options.seed = cmd.getUint("seed", 1);
+	options.thread_count = cmd.threads();
+
+	PermutationTest engine(reader, phenotype, options);
+	engine.write(cmd.out(), pheno_name);
+
+	cout << options.permutations << " permutations written to " << cmd.out() << "." << pheno_name << ".assoc.perm" << endl;
+}
+
+// epistasis [--pheno-name col] [--epi-p x] [--memory MB] [--out prefix] [--threads N]
+static void runEpistasis(Plink2Reader& reader, const CommandLine& cmd)
+{
+	const std::string pheno_name = cmd.get("pheno-name", "PHENO1");
+
+	Matrix phenotype;
+	readPhenotypeColumn(reader, pheno_name, phenotype);
+	caseControlPhenotype(phenotype);
+
+	EpistasisOptions options;
+	options.report_p = cmd.getDouble("epi-p", options.report_p);
+	options.memory_budget = static_cast<uint64_t>(cmd.getUint("memory", 1024)) << 20;
+	options.thread_count = cmd.threads();
+
+	EpistasisScan engine(reader, phenotype, options);
+	engine.write(cmd.out());
+
+	cout << engine.results.size() << " of " << engine.pairs_tested << " pairs with p < " << options.report_p << " ("
+		<< engine.pairs_refitted << " refitted after screening) written to " << cmd.out() << ".epi.cc" << endl;
+}
+
+// burden --regions file [--pheno-name col] [--max-maf x] [--flat-weights] [--out prefix] [--threads N]
+static void runBurden(Plink2Reader& reader, const CommandLine& cmd)
+{
+	const std::string pheno_name = cmd.get("pheno-name", "PHENO1");
+
+	Matrix phenotype;
+	readPhenotypeColumn(reader, pheno_name, phenotype);
+
+	std::vector<VariantInfo> variants;
+	std::vector<BurdenRegion> regions;
+	reader.readVariantInfo(variants);
+	readBurdenRegions(cmd.require("regions"), variants, regions);
+
+	BurdenOptions options;
+	options.max_maf = cmd.getDouble("max-maf", options.max_maf);
+	options.beta_weights = !cmd.has("flat-weights");
+	options.thread_count = cmd.threads();
+
+	RegionBurdenTest engine(reader, phenotype, regions, options);
+	engine.write(cmd.out(), pheno_name);
+
+	cout << "Burden and SKAT tests of " << regions.size() << " set(s) on " << engine.sampleCount() << " samples written to "
+		<< cmd.out() << "." << pheno_name << ".burden" << endl;
+}
+
+// fst --group col [--out prefix] [--threads N]
+static void runFst(Plink2Reader& reader, const CommandLine& cmd)
+{
+	const std::string column = cmd.require("group");
+
+	FstOptions options;
+	options.thread_count = cmd.threads();
+
+	GroupFstEngine engine(reader, column, options);
+	engine.write(cmd.out(), column);
+
+	const uint32_t groups = engine.sampleGroups().count();
+
+	cout << "Spectra of " << groups << " group(s) and Fst of " << groups * (groups - 1) / 2 << " pair(s) written to "
+		<< cmd.out() << "." << column << ".sfs/.fst.summary" << endl;
+}
+
+// duplicates [--out prefix] [--threads N]
+static void runDuplicates(Plink2Reader& reader, const CommandLine& cmd)
+{
+	DuplicateOptions options;
+	options.thread_count = cmd.threads();
+
+	DuplicateDetector engine(reader, options);
+	engine.write(cmd.out());
+
+	cout << engine.duplicate_variants.size() << " duplicate variant group(s) and " << engine.duplicate_samples.size()
+		<< " duplicate sample group(s) written to " << cmd.out() << ".dupvar/.dupsample";
+
+	if (engine.unverified_collisions)
+		cout << " (" << engine.unverified_collisions << " hash collision(s) rejected on comparison)";
+
+	cout << endl;
+}
+
+int main(int argc, char** argv)
+{
+	try
+	{
+		const CommandLine cmd(argc, argv);
+		const std::string pfile = cmd.pfile();
+
+		Plink2Reader reader(pfile + ".pgen", pfile + ".pvar", pfile + ".psam");
+
+		if (cmd.mode.empty())
+			runExample(reader);
+		else if (cmd.mode == "make-sample-major")
+			runMakeSampleMajor(reader, cmd);
+		else if (cmd.mode == "sample-genotypes")
+			runSampleGenotypes(reader, cmd);
+		else if (cmd.mode == "make-grm")
+			runMakeGrm(reader, cmd);
+		else if (cmd.mode == "ibs")
+			runIbs(reader, cmd);
+		else if (cmd.mode == "king")
+			runKing(reader, cmd);
+		else if (cmd.mode == "pca")
+			runPca(reader, cmd);
+		else if (cmd.mode == "linear")
+			runLinear(reader, cmd);
+		else if (cmd.mode == "logistic")
+			runLogistic(reader, cmd);
+		else if (cmd.mode == "score")
+			runScore(reader, cmd);
+		else if (cmd.mode == "ld")
+			runLd(reader, cmd);
+		else if (cmd.mode == "indep-pairwise")
+			runIndepPairwise(reader, cmd);
+		else if (cmd.mode == "clump")
+			runClump(reader, cmd);
+		else if (cmd.mode == "hardy")
+			runHardy(reader, cmd);
+		else if (cmd.mode == "sample-qc")
+			runSampleQc(reader, cmd);
+		else if (cmd.mode == "freq")
+			runFreq(reader, cmd);
+		else if (cmd.mode == "check-sex")
+			runCheckSex(reader, cmd);
+		else if (cmd.mode == "assoc")
+			runAssoc(reader, cmd);
+		else if (cmd.mode == "assoc-perm")
+			runAssocPerm(reader, cmd);
+		else if (cmd.mode == "epistasis")
+			runEpistasis(reader, cmd);
+		else if (cmd.mode == "burden")
+			runBurden(reader, cmd);
+		else if (cmd.mode == "fst")
+			runFst(reader, cmd);
+		else if (cmd.mode == "duplicates")
+			runDuplicates(reader, cmd);
+		else
+			throw std::invalid_argument("Unknown mode " + cmd.mode);
 	}
 	catch (const std::exception& e)
 	{
@@ -203,4 +608,4 @@ int main(void)
 	}
 
 	return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,385 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+#include <cmath>
+
+#if defined(__BMI2__) || defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+// Decoded hardcalls are kept in the PGEN 2-bit encoding, 32 genotypes per
+// 64-bit word, low bits first:
+//   0 = hom ref, 1 = het, 2 = hom alt, 3 = missing
+// Bits past the last sample of a variant are always zero.
+
+const uint64_t kMask5555 = 0x5555555555555555ULL;
+const uint64_t kMaskAAAA = 0xAAAAAAAAAAAAAAAAULL;
+const uint32_t kGenotypesPerWord = 32;
+
+inline uint32_t packedWordCount(uint32_t sample_count)
+{
+	return (sample_count + kGenotypesPerWord - 1) / kGenotypesPerWord;
+}
+
+inline int getPackedGenotype(const uint64_t* packed, uint32_t sample)
+{
+	return static_cast<int>((packed[sample / kGenotypesPerWord] >> (2 * (sample % kGenotypesPerWord))) & 3);
+}
+
+inline void setPackedGenotype(uint64_t* packed, uint32_t sample, uint64_t genotype)
+{
+	const uint32_t shift = 2 * (sample % kGenotypesPerWord);
+	uint64_t& word = packed[sample / kGenotypesPerWord];
+	word = (word & ~(3ULL << shift)) | (genotype << shift);
+}
+
+// Zero the unused high fields of the last word of a packed variant
+inline void clearPackedPadding(uint64_t* packed, uint32_t sample_count)
+{
+	const uint32_t remainder = sample_count % kGenotypesPerWord;
+
+	if (remainder)
+		packed[sample_count / kGenotypesPerWord] &= (1ULL << (2 * remainder)) - 1;
+}
+
+// Spread the low 32 bits of x so bit i lands on bit 2i
+inline uint64_t spreadBits(uint64_t x)
+{
+	x &= 0xFFFFFFFFULL;
+	x = (x | (x << 16)) & 0x0000FFFF0000FFFFULL;
+	x = (x | (x << 8)) & 0x00FF00FF00FF00FFULL;
+	x = (x | (x << 4)) & 0x0F0F0F0F0F0F0F0FULL;
+	x = (x | (x << 2)) & 0x3333333333333333ULL;
+	x = (x | (x << 1)) & 0x5555555555555555ULL;
+	return x;
+}
+
+// Inverse of spreadBits: gather the even bits of x into the low 32 bits
+inline uint64_t compressEvenBits(uint64_t x)
+{
+#ifdef __BMI2__
+	return _pext_u64(x, kMask5555);
+#else
+	x &= kMask5555;
+	x = (x | (x >> 1)) & 0x3333333333333333ULL;
+	x = (x | (x >> 2)) & 0x0F0F0F0F0F0F0F0FULL;
+	x = (x | (x >> 4)) & 0x00FF00FF00FF00FFULL;
+	x = (x | (x >> 8)) & 0x0000FFFF0000FFFFULL;
+	x = (x | (x >> 16)) & 0x00000000FFFFFFFFULL;
+	return x;
+#endif
+}
+
+// Gather the bits of x selected by mask into the low bits of the result
+inline uint64_t extractBits(uint64_t x, uint64_t mask)
+{
+#ifdef __BMI2__
+	return _pext_u64(x, mask);
+#else
+	uint64_t result = 0;
+
+	for (uint64_t bit = 1; mask; bit <<= 1)
+	{
+		if (x & mask & (~mask + 1))
+			result |= bit;
+
+		mask &= mask - 1;
+	}
+
+	return result;
+#endif
+}
+
+inline uint32_t popcount64(uint64_t x)
+{
+	return static_cast<uint32_t>(__builtin_popcountll(x));
+}
+
+// Samples of packed word `word` (32 samples) selected by a 1-bit-per-sample mask
+inline uint32_t sampleMaskChunk(const uint64_t* sample_mask, uint32_t word)
+{
+	return static_cast<uint32_t>(sample_mask[word / 2] >> (32 * (word % 2)));
+}
+
+// Appends 2-bit fields to a zero-initialized packed row
+struct PackedRowWriter {
+	uint64_t* row;
+	uint32_t bit;
+
+	explicit PackedRowWriter(uint64_t* row) : row(row), bit(0) {}
+
+	void append(uint64_t fields, uint32_t bit_count)
+	{
+		if (!bit_count)
+			return;
+
+		if (bit_count < 64)
+			fields &= (1ULL << bit_count) - 1;
+
+		const uint32_t offset = bit % 64;
+		row[bit / 64] |= fields << offset;
+
+		if (offset + bit_count > 64)
+			row[bit / 64 + 1] |= fields >> (64 - offset);
+
+		bit += bit_count;
+	}
+};
+
+// Compact the samples selected by sample_mask out of a packed row
+inline void compactPackedRow(const uint64_t* row, uint32_t words, const uint64_t* sample_mask, uint64_t* compacted, uint32_t compacted_words)
+{
+	std::memset(compacted, 0, static_cast<size_t>(compacted_words) * sizeof(uint64_t));
+	PackedRowWriter writer(compacted);
+
+	for (uint32_t word = 0; word < words; ++word)
+	{
+		const uint32_t include = sampleMaskChunk(sample_mask, word);
+
+		if (include == 0xffffffffu)
+			writer.append(row[word], 64);
+		else if (include)
+			writer.append(extractBits(row[word], spreadBits(include) * 3), 2 * popcount64(include));
+	}
+}
+
+// Split a packed row of field_count 2-bit fields into bit planes of 64 fields
+// per word: low gets bit 0 of every field and high bit 1, so
+//   het = low & ~high, hom alt = high & ~low, missing = low & high.
+// Fields past field_count are marked missing in both planes.
+inline void splitBitPlanes(const uint64_t* row, uint32_t field_count, uint64_t* low, uint64_t* high)
+{
+	const uint32_t plane_words = (field_count + 63) / 64;
+	const uint32_t row_words = packedWordCount(field_count);
+
+	for (uint32_t word = 0; word < plane_words; ++word)
+	{
+		const uint64_t first = row[2 * word];
+		const uint64_t second = (2 * word + 1 < row_words) ? row[2 * word + 1] : 0;
+
+		low[word] = compressEvenBits(first) | (compressEvenBits(second) << 32);
+		high[word] = compressEvenBits(first >> 1) | (compressEvenBits(second >> 1) << 32);
+	}
+
+	if (field_count % 64)
+	{
+		const uint64_t padding = ~((1ULL << (field_count % 64)) - 1);
+		low[plane_words - 1] |= padding;
+		high[plane_words - 1] |= padding;
+	}
+}
+
+struct GenotypeCounts {
+	uint32_t hom_ref;
+	uint32_t het;
+	uint32_t hom_alt;
+	uint32_t missing;
+};
+
+// Hardcall counts of one packed row, by popcount over the two bit planes
+inline GenotypeCounts countPackedGenotypes(const uint64_t* row, uint32_t words, uint32_t sample_count)
+{
+	GenotypeCounts counts = { 0, 0, 0, 0 };
+
+	for (uint32_t word = 0; word < words; ++word)
+	{
+		const uint64_t low = row[word] & kMask5555;
+		const uint64_t high = (row[word] >> 1) & kMask5555;
+
+		counts.het += popcount64(low & ~high);
+		counts.hom_alt += popcount64(high & ~low);
+		counts.missing += popcount64(low & high);
+	}
+
+	counts.hom_ref = sample_count - counts.het - counts.hom_alt - counts.missing;
+	return counts;
+}
+
+// ALT allele frequency among called genotypes (0 when nothing is called)
+inline double altAlleleFrequency(const GenotypeCounts& counts)
+{
+	const uint32_t called = counts.hom_ref + counts.het + counts.hom_alt;
+	return called ? (counts.het + 2.0 * counts.hom_alt) / (2.0 * called) : 0.0;
+}
+
+// Per-code values of the standardized genotype (x - 2p) / sqrt(2p(1 - p)),
+// missing mapped to 0 (mean imputation). The variant must be polymorphic.
+inline void standardizedGenotypeValues(const GenotypeCounts& counts, double values[4])
+{
+	const double p = altAlleleFrequency(counts);
+	const double scale = 1.0 / std::sqrt(2.0 * p * (1.0 - p));
+
+	values[0] = (0.0 - 2.0 * p) * scale;
+	values[1] = (1.0 - 2.0 * p) * scale;
+	values[2] = (2.0 - 2.0 * p) * scale;
+	values[3] = 0.0;
+}
+
+// Swap hom ref and hom alt (0 <-> 2), leaving het and missing alone
+inline uint64_t invertGenotypeWord(uint64_t word)
+{
+	return word ^ ((~word & kMask5555) << 1);
+}
+
+// Transpose a 32x32 tile of 2-bit genotypes in place, so field j of word i
+// moves to field i of word j. Word i of a variant-major tile is one variant
+// over 32 samples; afterwards word i is one sample over the 32 variants.
+// Recursive block swap: at each level the off-diagonal halves of every
+// 2j x 2j block are exchanged with shift/xor/mask.
+inline void transposeGenotypeTile(uint64_t* tile)
+{
+	static const uint64_t masks[5] = {
+		0x00000000FFFFFFFFULL,
+		0x0000FFFF0000FFFFULL,
+		0x00FF00FF00FF00FFULL,
+		0x0F0F0F0F0F0F0F0FULL,
+		0x3333333333333333ULL
+	};
+
+#ifdef __AVX2__
+	// Levels j = 16, 8, 4 pair rows 4 apart or more: swap 4 row pairs per step
+	for (uint32_t level = 0, j = 16; j >= 4; ++level, j >>= 1)
+	{
+		const __m256i mask = _mm256_set1_epi64x(static_cast<long long>(masks[level]));
+
+		for (uint32_t k = 0; k < 32; k = (k + j + 4) & ~j)
+		{
+			__m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(tile + k));
+			__m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(tile + k + j));
+			const __m256i t = _mm256_and_si256(_mm256_xor_si256(_mm256_srli_epi64(a, 2 * j), b), mask);
+			a = _mm256_xor_si256(a, _mm256_slli_epi64(t, 2 * j));
+			b = _mm256_xor_si256(b, t);
+			_mm256_storeu_si256(reinterpret_cast<__m256i*>(tile + k), a);
+			_mm256_storeu_si256(reinterpret_cast<__m256i*>(tile + k + j), b);
+		}
+	}
+
+	// Levels j = 2 and 1 pair rows inside one 4-row vector: shuffle the partner
+	// lanes into place, then blend the two halves of the swap back together
+	const __m256i mask2 = _mm256_set1_epi64x(static_cast<long long>(masks[3]));
+	const __m256i mask1 = _mm256_set1_epi64x(static_cast<long long>(masks[4]));
+
+	for (uint32_t k = 0; k < 32; k += 4)
+	{
+		__m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(tile + k));
+
+		__m256i t = _mm256_and_si256(_mm256_xor_si256(_mm256_srli_epi64(v, 4), _mm256_permute4x64_epi64(v, 0x4E)), mask2);
+		v = _mm256_blend_epi32(
+			_mm256_xor_si256(v, _mm256_slli_epi64(t, 4)),
+			_mm256_xor_si256(v, _mm256_permute4x64_epi64(t, 0x4E)),
+			0xF0);
+
+		t = _mm256_and_si256(_mm256_xor_si256(_mm256_srli_epi64(v, 2), _mm256_permute4x64_epi64(v, 0xB1)), mask1);
+		v = _mm256_blend_epi32(
+			_mm256_xor_si256(v, _mm256_slli_epi64(t, 2)),
+			_mm256_xor_si256(v, _mm256_permute4x64_epi64(t, 0xB1)),
+			0xCC);
+
+		_mm256_storeu_si256(reinterpret_cast<__m256i*>(tile + k), v);
+	}
+#else
+	for (uint32_t level = 0, j = 16; j != 0; ++level, j >>= 1)
+	{
+		for (uint32_t k = 0; k < 32; k = (k + j + 1) & ~j)
+		{
+			const uint64_t t = ((tile[k] >> (2 * j)) ^ tile[k + j]) & masks[level];
+			tile[k] ^= t << (2 * j);
+			tile[k + j] ^= t;
+		}
+	}
+#endif
+}
+
+// Transpose variant-major packed rows (variant_count rows of
+// packedWordCount(sample_count) words) into sample-major packed rows
+// (sample_count rows of packedWordCount(variant_count) words, field v of a
+// row being that sample's genotype at variant v)
+inline void transposePackedGenotypes(const uint64_t* variant_major, uint32_t variant_count, uint32_t sample_count, std::vector<uint64_t>& sample_major)
+{
+	const uint32_t sample_words = packedWordCount(sample_count);
+	const uint32_t variant_words = packedWordCount(variant_count);
+
+	sample_major.assign(static_cast<size_t>(sample_count) * variant_words, 0);
+
+	uint64_t tile[32];
+
+	for (uint32_t variant_word = 0; variant_word < variant_words; ++variant_word)
+	{
+		const uint32_t first_variant = variant_word * kGenotypesPerWord;
+		const uint32_t tile_variants = std::min(kGenotypesPerWord, variant_count - first_variant);
+
+		for (uint32_t sample_word = 0; sample_word < sample_words; ++sample_word)
+		{
+			for (uint32_t i = 0; i < tile_variants; ++i)
+				tile[i] = variant_major[static_cast<size_t>(first_variant + i) * sample_words + sample_word];
+
+			for (uint32_t i = tile_variants; i < 32; ++i)
+				tile[i] = 0;
+
+			transposeGenotypeTile(tile);
+
+			const uint32_t first_sample = sample_word * kGenotypesPerWord;
+			const uint32_t tile_samples = std::min(kGenotypesPerWord, sample_count - first_sample);
+
+			for (uint32_t i = 0; i < tile_samples; ++i)
+				sample_major[static_cast<size_t>(first_sample + i) * variant_words + variant_word] = tile[i];
+		}
+	}
+}
+
+// Expand a [variant][packed sample] block into the [sample][variant] int
+// layout used by readGenotypesChunk (-1 for missing). Works in 32x32 tiles
+// transposed in registers, so each sample's row is written sequentially.
+inline void unpackGenotypeTile(
+	const uint64_t* packed,
+	uint32_t words_per_variant,
+	uint32_t variant_count,
+	uint32_t start_sample,
+	uint32_t end_sample,
+	std::vector<std::vector<int>>& genotypes)
+{
+	static const int genotype_values[4] = { 0, 1, 2, -1 }; // -1 for missing
+
+	const uint32_t num_samples = end_sample - start_sample;
+
+	genotypes.resize(num_samples);
+
+	for (uint32_t sample = 0; sample < num_samples; ++sample)
+		genotypes[sample].resize(variant_count);
+
+	if (!num_samples)
+		return;
+
+	uint64_t tile[32];
+
+	for (uint32_t first_variant = 0; first_variant < variant_count; first_variant += kGenotypesPerWord)
+	{
+		const uint32_t tile_variants = std::min(kGenotypesPerWord, variant_count - first_variant);
+
+		for (uint32_t sample_word = start_sample / kGenotypesPerWord; sample_word <= (end_sample - 1) / kGenotypesPerWord; ++sample_word)
+		{
+			for (uint32_t i = 0; i < tile_variants; ++i)
+				tile[i] = packed[static_cast<size_t>(first_variant + i) * words_per_variant + sample_word];
+
+			for (uint32_t i = tile_variants; i < 32; ++i)
+				tile[i] = 0;
+
+			transposeGenotypeTile(tile);
+
+			const uint32_t tile_start = std::max(start_sample, sample_word * kGenotypesPerWord);
+			const uint32_t tile_end = std::min(end_sample, (sample_word + 1) * kGenotypesPerWord);
+
+			for (uint32_t sample = tile_start; sample < tile_end; ++sample)
+			{
+				uint64_t fields = tile[sample % kGenotypesPerWord];
+				int* out = &genotypes[sample - start_sample][first_variant];
+
+				for (uint32_t i = 0; i < tile_variants; ++i, fields >>= 2)
+					out[i] = genotype_values[fields & 3];
+			}
+		}
+	}
+}
@@ -0,0 +1,82 @@
+#pragma once
+
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <exception>
+#include <cstdint>
+#include <algorithm>
+#include <cmath>
+
+inline uint32_t defaultThreadCount()
+{
+	return std::max(1u, std::thread::hardware_concurrency());
+}
+
+// Map index to the (row, col) pair it numbers in a row-major walk of a
+// lower triangle including the diagonal: (0,0), (1,0), (1,1), (2,0), ...
+inline void lowerTrianglePair(uint32_t index, uint32_t& row, uint32_t& col)
+{
+	row = static_cast<uint32_t>((std::sqrt(8.0 * index + 1.0) - 1.0) / 2.0);
+
+	while (static_cast<uint64_t>(row) * (row + 1) / 2 > index)
+		row--;
+
+	while (static_cast<uint64_t>(row + 1) * (row + 2) / 2 <= index)
+		row++;
+
+	col = index - row * (row + 1) / 2;
+}
+
+// Run fn(task, thread_index) for every task in [0, task_count) on up to
+// thread_count threads. Tasks are handed out dynamically; the first exception
+// thrown by any task is rethrown on the calling thread.
+template <typename Fn>
+void parallelFor(uint32_t task_count, uint32_t thread_count, Fn fn)
+{
+	thread_count = std::max(1u, std::min(thread_count, task_count));
+
+	if (thread_count <= 1)
+	{
+		for (uint32_t task = 0; task < task_count; ++task)
+			fn(task, 0u);
+
+		return;
+	}
+
+	std::atomic<uint32_t> next_task(0);
+	std::exception_ptr error;
+	std::mutex error_mutex;
+
+	auto worker = [&](uint32_t thread_index)
+	{
+		try
+		{
+			for (uint32_t task = next_task++; task < task_count; task = next_task++)
+				fn(task, thread_index);
+		}
+		catch (...)
+		{
+			std::lock_guard<std::mutex> lock(error_mutex);
+
+			if (!error)
+				error = std::current_exception();
+
+			next_task = task_count;
+		}
+	};
+
+	std::vector<std::thread> threads;
+
+	for (uint32_t t = 1; t < thread_count; ++t)
+		threads.emplace_back(worker, t);
+
+	worker(0);
+
+	for (std::thread& thread : threads)
+		thread.join();
+
+	if (error)
+		std::rethrow_exception(error);
+}
@@ -0,0 +1,240 @@
+#pragma once
+
+#include <fstream>
+#include <vector>
+#include <string>
+#include <random>
+#include <stdexcept>
+#include <cstdint>
+#include <cmath>
+#include <algorithm>
+
+#include "plink2_reader.h"
+#include "parallel.h"
+#include "linear_algebra.h"
+
+struct PcaOptions {
+	uint32_t pcs = 10;
+	uint32_t oversample = 10;
+	uint32_t iterations = 10;
+	uint32_t block_variants = 256;
+	uint32_t thread_count = 1;
+	double min_maf = 0.0;
+	uint64_t seed = 1;
+};
+
+// Top principal components of the standardized genotype matrix X (variants x
+// samples) by randomized subspace iteration. Each product with the GRM,
+// X^T X Q, is one streaming pass: per variant block T = Z Q, then Y += Z^T T,
+// with Z's entries looked up from packed genotypes on the fly. Only sample x
+// (pcs + oversample) panels are held, never the genotype matrix or the GRM.
+class PcaEngine {
+private:
+	Plink2Reader& reader;
+	PcaOptions options;
+
+	// X^T X q over every polymorphic variant passing the MAF filter
+	Matrix gramProduct(const Matrix& q)
+	{
+		const uint32_t sample_count = reader.sample_count;
+		const uint32_t width = q.cols;
+		const uint32_t words = reader.packed_words;
+
+		VariantFilter filter;
+		filter.min_maf = options.min_maf;
+		filter.skip_monomorphic = true;
+
+		Matrix y(sample_count, width);
+		std::vector<uint64_t> packed;
+		std::vector<uint32_t> kept;
+		std::vector<double> values;
+		Matrix t;
+
+		variants_used = 0;
+
+		for (uint32_t block_start = 0; block_start < reader.variant_count; block_start += options.block_variants)
+		{
+			const uint32_t block_end = std::min(block_start + options.block_variants, reader.variant_count);
+
+			reader.readFilteredVariants(packed, kept, block_start, block_end, filter);
+
+			const uint32_t kept_count = static_cast<uint32_t>(kept.size());
+
+			if (!kept_count)
+				continue;
+
+			values.resize(static_cast<size_t>(kept_count) * 4);
+			t = Matrix(kept_count, width);
+
+			// T = Z q, one variant per task
+			parallelFor(kept_count, options.thread_count,
+				[&](uint32_t v, uint32_t)
+				{
+					const uint64_t* row = &packed[static_cast<size_t>(v) * words];
+					double* value = &values[static_cast<size_t>(v) * 4];
+					double* out = t.row(v);
+
+					standardizedGenotypeValues(countPackedGenotypes(row, words, sample_count), value);
+
+					for (uint32_t word = 0; word < words; ++word)
+					{
+						uint64_t fields = row[word];
+						const uint32_t last = std::min((word + 1) * kGenotypesPerWord, sample_count);
+
+						for (uint32_t sample = word * kGenotypesPerWord; sample < last; ++sample, fields >>= 2)
+						{
+							const double z = value[fields & 3];
+							const double* qs = q.row(sample);
+
+							for (uint32_t c = 0; c < width; ++c)
+								out[c] += z * qs[c];
+						}
+					}
+				});
+
+			// Y += Z^T T, one packed word (32 samples) per task so Y rows stay in L1
+			parallelFor(words, options.thread_count,
+				[&](uint32_t word, uint32_t)
+				{
+					const uint32_t first = word * kGenotypesPerWord;
+					const uint32_t last = std::min(first + kGenotypesPerWord, sample_count);
+
+					for (uint32_t v = 0; v < kept_count; ++v)
+					{
+						uint64_t fields = packed[static_cast<size_t>(v) * words + word];
+						const double* value = &values[static_cast<size_t>(v) * 4];
+						const double* tv = t.row(v);
+
+						for (uint32_t sample = first; sample < last; ++sample, fields >>= 2)
+						{
+							const double z = value[fields & 3];
+							double* ys = y.row(sample);
+
+							for (uint32_t c = 0; c < width; ++c)
+								ys[c] += z * tv[c];
+						}
+					}
+				});
+
+			variants_used += kept_count;
+		}
+
+		return y;
+	}
+
+public:
+	uint32_t variants_used;
+
+	// GRM eigenvalues (X^T X / M) and unit-norm sample eigenvectors, one column per PC
+	std::vector<double> eigenvalues;
+	Matrix eigenvectors;
+
+	PcaEngine(Plink2Reader& reader, const PcaOptions& options)
+		: reader(reader), options(options), variants_used(0)
+	{
+		if (options.pcs == 0 || options.block_variants == 0)
+			throw std::invalid_argument("PCA needs at least one PC and a nonzero block size");
+	}
+
+	void compute()
+	{
+		const uint32_t sample_count = reader.sample_count;
+		const uint32_t pcs = std::min(options.pcs, sample_count);
+		const uint32_t width = std::min(pcs + options.oversample, sample_count);
+
+		std::mt19937_64 rng(options.seed);
+		std::normal_distribution<double> normal;
+
+		Matrix y(sample_count, width);
+
+		for (double& value : y.data)
+			value = normal(rng);
+
+		// Power iterations sharpen the subspace toward the top eigenvectors
+		for (uint32_t iteration = 0; iteration <= options.iterations; ++iteration)
+		{
+			orthonormalizeColumns(y);
+			y = gramProduct(y);
+		}
+
+		if (!variants_used)
+			throw std::runtime_error("No polymorphic variants for PCA");
+
+		// Rayleigh-Ritz on the final basis
+		Matrix q = y;
+		orthonormalizeColumns(q);
+
+		const Matrix w = gramProduct(q);
+		Matrix small = multiplyTransposed(q, w);
+
+		for (uint32_t i = 0; i < width; ++i)
+		{
+			for (uint32_t j = 0; j < i; ++j)
+				small(i, j) = small(j, i) = 0.5 * (small(i, j) + small(j, i));
+		}
+
+		std::vector<double> values;
+		Matrix rotation;
+		symmetricEigen(small, values, rotation);
+
+		const Matrix vectors = multiply(q, rotation);
+
+		eigenvalues.resize(pcs);
+		eigenvectors = Matrix(sample_count, pcs);
+
+		for (uint32_t pc = 0; pc < pcs; ++pc)
+		{
+			eigenvalues[pc] = values[pc] / variants_used;
+
+			// Fix the sign so the largest-magnitude loading is positive
+			uint32_t largest = 0;
+
+			for (uint32_t sample = 1; sample < sample_count; ++sample)
+			{
+				if (std::fabs(vectors(sample, pc)) > std::fabs(vectors(largest, pc)))
+					largest = sample;
+			}
+
+			const double sign = vectors(largest, pc) < 0 ? -1.0 : 1.0;
+
+			for (uint32_t sample = 0; sample < sample_count; ++sample)
+				eigenvectors(sample, pc) = sign * vectors(sample, pc);
+		}
+	}
+
+	// <prefix>.eigenvec (sample IDs then PC1..PCk) and <prefix>.eigenval
+	void write(const std::string& prefix)
+	{
+		std::vector<std::string> labels;
+		const bool has_fid = readSampleLabels(reader, labels);
+
+		std::ofstream vec(prefix + ".eigenvec");
+		std::ofstream val(prefix + ".eigenval");
+
+		if (!vec.is_open() || !val.is_open())
+			throw std::runtime_error("Failed to open PCA output files");
+
+		vec << (has_fid ? "#FID\tIID" : "#IID");
+
+		for (uint32_t pc = 0; pc < eigenvectors.cols; ++pc)
+			vec << "\tPC" << pc + 1;
+
+		vec << '\n';
+
+		for (uint32_t sample = 0; sample < reader.sample_count; ++sample)
+		{
+			vec << labels[sample];
+
+			for (uint32_t pc = 0; pc < eigenvectors.cols; ++pc)
+				vec << '\t' << eigenvectors(sample, pc);
+
+			vec << '\n';
+		}
+
+		for (double value : eigenvalues)
+			val << value << '\n';
+
+		if (!vec || !val)
+			throw std::runtime_error("Failed to write PCA output");
+	}
+};
@@ -0,0 +1,256 @@
+#pragma once
+
+#include <fstream>
+#include <vector>
+#include <string>
+#include <random>
+#include <stdexcept>
+#include <cstdint>
+#include <cmath>
+#include <algorithm>
+
+#include "plink2_reader.h"
+#include "parallel.h"
+#include "case_control.h"
+
+struct PermutationOptions {
+	uint32_t permutations = 1000;
+	uint64_t seed = 1;
+	uint32_t block_variants = 1024;
+	uint32_t thread_count = 1;
+};
+
+// Empirical p-values for the allelic chi-square by case/control label
+// permutation. Every permutation is stored as a case bitset (64 samples per
+// word) over the samples with a phenotype, keeping the case count. Each
+// decoded variant is split into bit planes once, and all permutations are
+// scored against it by AND + popcount. EMP1 is the
+// per-variant empirical p, EMP2 the max(T) family-wise one over all variants.
+class PermutationTest {
+private:
+	Plink2Reader& reader;
+	PermutationOptions options;
+
+	uint32_t plane_words;
+	uint32_t case_count;
+	uint32_t control_count;
+
+	// Samples with a phenotype, the observed cases, then one case set per permutation
+	std::vector<uint64_t> included;
+	std::vector<uint64_t> observed_cases;
+	std::vector<uint64_t> permuted_cases;
+
+	// Allelic chi-square from the ALT copies and missing calls of all included
+	// samples and of the cases
+	double allelicStatistic(uint32_t alt_total, uint32_t missing_total, uint32_t case_alt, uint32_t case_missing) const
+	{
+		const double case_called = case_count - case_missing;
+		const double control_called = control_count - (missing_total - case_missing);
+		const double control_alt = static_cast<double>(alt_total) - case_alt;
+		const double cases[2] = { static_cast<double>(case_alt), 2.0 * case_called - case_alt };
+		const double controls[2] = { control_alt, 2.0 * control_called - control_alt };
+		uint32_t df;
+
+		return tableChiSquare(cases, controls, 2, df);
+	}
+
+public:
+	std::vector<double> statistics;
+	std::vector<uint32_t> exceed_counts;
+
+	// Largest statistic over all variants in each permutation
+	std::vector<double> permutation_max;
+
+	PermutationTest(Plink2Reader& reader, const Matrix& phenotype, const PermutationOptions& options)
+		: reader(reader), options(options), plane_words((reader.sample_count + 63) / 64), case_count(0), control_count(0),
+		  included(plane_words, 0), observed_cases(plane_words, 0)
+	{
+		if (options.permutations == 0 || options.block_variants == 0)
+			throw std::invalid_argument("Permutation and block counts must be nonzero");
+
+		if (phenotype.rows != reader.sample_count)
+			throw std::invalid_argument("Phenotype does not match the sample count");
+
+		std::vector<uint32_t> samples;
+
+		for (uint32_t sample = 0; sample < phenotype.rows; ++sample)
+		{
+			const double value = phenotype(sample, 0);
+
+			if (value != 0.0 && value != 1.0)
+				continue;
+
+			samples.push_back(sample);
+			included[sample / 64] |= 1ULL << (sample % 64);
+
+			if (value == 1.0)
+			{
+				observed_cases[sample / 64] |= 1ULL << (sample % 64);
+				case_count++;
+			}
+			else
+				control_count++;
+		}
+
+		if (!case_count || !control_count)
+			throw std::runtime_error("Permutation test needs both cases and controls");
+
+		// The first case_count samples of each shuffle are the permutation's cases
+		std::mt19937_64 rng(options.seed);
+		permuted_cases.assign(static_cast<size_t>(options.permutations) * plane_words, 0);
+
+		for (uint32_t permutation = 0; permutation < options.permutations; ++permutation)
+		{
+			uint64_t* cases = &permuted_cases[static_cast<size_t>(permutation) * plane_words];
+
+			for (uint32_t i = 0; i < case_count; ++i)
+			{
+				std::uniform_int_distribution<size_t> pick(i, samples.size() - 1);
+				std::swap(samples[i], samples[pick(rng)]);
+				cases[samples[i] / 64] |= 1ULL << (samples[i] % 64);
+			}
+		}
+	}
+
+	void compute()
+	{
+		const uint32_t variant_count = reader.variant_count;
+		const uint32_t sample_count = reader.sample_count;
+		const uint32_t words = reader.packed_words;
+		const uint32_t permutations = options.permutations;
+		const uint32_t threads = std::max(1u, options.thread_count);
+
+		statistics.assign(variant_count, 0.0);
+		exceed_counts.assign(variant_count, 0);
+
+		// Per-thread planes and max(T) partials
+		std::vector<std::vector<uint64_t>> scratch(threads, std::vector<uint64_t>(3 * static_cast<size_t>(plane_words)));
+		std::vector<std::vector<double>> thread_max(threads, std::vector<double>(permutations, 0.0));
+		std::vector<uint64_t> packed;
+
+		for (uint32_t start = 0; start < variant_count; start += options.block_variants)
+		{
+			const uint32_t end = std::min(start + options.block_variants, variant_count);
+
+			reader.readPackedVariants(packed, start, end);
+
+			parallelFor(end - start, threads,
+				[&](uint32_t offset, uint32_t thread_index)
+				{
+					uint64_t* low = scratch[thread_index].data();
+					uint64_t* high = low + plane_words;
+					uint64_t* missing = high + plane_words;
+					std::vector<double>& maxima = thread_max[thread_index];
+
+					splitBitPlanes(&packed[static_cast<size_t>(offset) * words], sample_count, low, high);
+
+					// A het sets low, a hom alt high and a missing call both, so the ALT
+					// copies of any sample set are popcount(low) + 2 popcount(high) less
+					// three per missing call
+					uint32_t alt_total = 0, missing_total = 0;
+
+					for (uint32_t word = 0; word < plane_words; ++word)
+					{
+						missing[word] = low[word] & high[word] & included[word];
+						low[word] &= included[word];
+						high[word] &= included[word];
+
+						alt_total += popcount64(low[word]) + 2 * popcount64(high[word]);
+						missing_total += popcount64(missing[word]);
+					}
+
+					alt_total -= 3 * missing_total;
+
+					auto statistic = [&](const uint64_t* cases)
+					{
+						uint32_t case_alt = 0, case_missing = 0;
+
+						for (uint32_t word = 0; word < plane_words; ++word)
+							case_alt += popcount64(low[word] & cases[word]) + 2 * popcount64(high[word] & cases[word]);
+
+						if (missing_total)
+						{
+							for (uint32_t word = 0; word < plane_words; ++word)
+								case_missing += popcount64(missing[word] & cases[word]);
+						}
+
+						return allelicStatistic(alt_total, missing_total, case_alt - 3 * case_missing, case_missing);
+					};
+
+					const uint32_t variant = start + offset;
+					const double observed = statistic(observed_cases.data());
+
+					statistics[variant] = observed;
+
+					if (std::isnan(observed))
+						return;
+
+					uint32_t exceeded = 0;
+
+					for (uint32_t permutation = 0; permutation < permutations; ++permutation)
+					{
+						const double permuted = statistic(&permuted_cases[static_cast<size_t>(permutation) * plane_words]);
+
+						if (std::isnan(permuted))
+							continue;
+
+						exceeded += permuted >= observed;
+						maxima[permutation] = std::max(maxima[permutation], permuted);
+					}
+
+					exceed_counts[variant] = exceeded;
+				});
+		}
+
+		permutation_max.assign(permutations, 0.0);
+
+		for (const std::vector<double>& maxima : thread_max)
+		{
+			for (uint32_t permutation = 0; permutation < permutations; ++permutation)
+				permutation_max[permutation] = std::max(permutation_max[permutation], maxima[permutation]);
+		}
+	}
+
+	// <prefix>.<name>.assoc.perm: observed allelic chi-square, EMP1 and EMP2
+	void write(const std::string& prefix, const std::string& name)
+	{
+		compute();
+
+		std::vector<VariantInfo> variants;
+		reader.readVariantInfo(variants);
+
+		std::vector<double> sorted_max = permutation_max;
+		std::sort(sorted_max.begin(), sorted_max.end());
+
+		const std::string path = prefix + "." + name + ".assoc.perm";
+		std::ofstream out(path);
+
+		if (!out.is_open())
+			throw std::runtime_error("Failed to open " + path);
+
+		const double denominator = options.permutations + 1.0;
+
+		out << "#CHROM\tPOS\tID\tCHISQ\tEMP1\tEMP2\n";
+
+		for (uint32_t variant = 0; variant < variants.size(); ++variant)
+		{
+			const VariantInfo& info = variants[variant];
+			const double observed = statistics[variant];
+
+			out << info.chrom << '\t' << info.pos << '\t' << info.id << '\t';
+
+			if (std::isnan(observed))
+			{
+				out << "NA\tNA\tNA\n";
+				continue;
+			}
+
+			const size_t max_exceeded = sorted_max.end() - std::lower_bound(sorted_max.begin(), sorted_max.end(), observed);
+
+			out << observed << '\t' << (exceed_counts[variant] + 1.0) / denominator << '\t' << (max_exceeded + 1.0) / denominator << '\n';
+		}
+
+		if (!out)
+			throw std::runtime_error("Failed to write " + path);
+	}
+};
@@ -0,0 +1,1353 @@
+#pragma once
+
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <string>
+#include <stdexcept>
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+#include <memory>
+#include <mutex>
+
+#include "packed_genotypes.h"
+#include "statistics.h"
+#include "block_cache.h"
+
+// Per-variant filters evaluated by readFilteredVariants before any dense expansion
+struct VariantFilter {
+	double min_maf = 0.0;
+	double max_missing_rate = 1.0;
+	bool skip_monomorphic = false;
+
+	// Variants with a Hardy-Weinberg exact p below this are dropped
+	double min_hwe_p = 0.0;
+
+	bool passes(const GenotypeCounts& counts, uint32_t sample_count) const
+	{
+		const uint32_t called = sample_count - counts.missing;
+
+		if (sample_count && static_cast<double>(counts.missing) / sample_count > max_missing_rate)
+			return false;
+
+		const uint64_t alt_alleles = counts.het + 2ULL * counts.hom_alt;
+		const uint64_t ref_alleles = counts.het + 2ULL * counts.hom_ref;
+
+		if (skip_monomorphic && (alt_alleles == 0 || ref_alleles == 0))
+			return false;
+
+		if (min_maf > 0.0)
+		{
+			if (called == 0)
+				return false;
+
+			const double alt_freq = static_cast<double>(alt_alleles) / (2.0 * called);
+
+			if (std::min(alt_freq, 1.0 - alt_freq) < min_maf)
+				return false;
+		}
+
+		if (min_hwe_p > 0.0 && hweExactPValue(counts.het, counts.hom_ref, counts.hom_alt) < min_hwe_p)
+			return false;
+
+		return true;
+	}
+};
+
+// One variant as a common genotype plus the samples (ascending) whose
+// genotype differs from it
+struct SparseVariant {
+	uint8_t common;
+	std::vector<uint32_t> samples;
+	std::vector<uint8_t> genotypes;
+};
+
+struct VariantInfo {
+	std::string chrom;
+	uint32_t pos;
+	std::string id;
+	std::string ref;
+	std::string alt;
+};
+
+class Plink2Reader {
+private:
+	std::ifstream pgen_file;
+	std::ifstream pvar_file;
+	std::ifstream psam_file;
+
+	// Per-variant record types and file offsets (variant_count + 1 entries)
+	std::vector<uint8_t> vrtypes;
+	std::vector<uint64_t> variant_offsets;
+
+	// Guards the file stream and the decode buffers below
+	std::mutex decode_mutex;
+	std::vector<uint8_t> record_buffer;
+	std::vector<uint64_t> ld_base_buffer;
+
+	std::unique_ptr<DecodedBlockCache> block_cache;
+
+	// Registered sample subset: include bitmask and each sample's compacted position
+	static constexpr uint32_t excluded_sample = 0xffffffffu;
+	std::vector<uint64_t> subset_mask;
+	std::vector<uint32_t> subset_positions;
+
+public:
+	uint32_t variant_count;
+	uint32_t sample_count;
+	uint64_t file_size;
+
+	// Words per decoded variant in the packed 2-bit representation
+	uint32_t packed_words;
+
+	// Size of the registered sample subset (0 until setSampleSubset is called)
+	uint32_t subset_sample_count;
+	uint32_t subset_words;
+
+	Plink2Reader(
+		const std::string& pgen_path,
+		const std::string& pvar_path,
+		const std::string& psam_path)
+	{
+		// Open files
+		pgen_file.open(pgen_path, std::ios::binary);
+		pvar_file.open(pvar_path);
+		psam_file.open(psam_path);
+
+		if (!pgen_file.is_open() || !pvar_file.is_open() || !psam_file.is_open())
+			throw std::runtime_error("Failed to open one or more PLINK2 files");
+
+		// Read header from pgen file
+		readHeader();
+	}
+
+	~Plink2Reader() {
+		if (pgen_file.is_open()) pgen_file.close();
+		if (pvar_file.is_open()) pvar_file.close();
+		if (psam_file.is_open()) psam_file.close();
+	}
+
+private:
+	static const uint32_t variant_block_size = 65536;
+
+	void readHeader()
+	{
+		// See: https://github.com/chrchang/plink-ng/blob/master/pgen_spec/pgen_spec.pdf
+
+		// Read magic numbers (first 2 bytes should be 0x6c, 0x1b)
+		char magic[2];
+		pgen_file.read(magic, 2);
+
+		if (magic[0] != 0x6c || magic[1] != 0x1b)
+			throw std::runtime_error("Invalid PGEN file format");
+
+		// Read mode byte
+		char storage_mode;
+		pgen_file.read(&storage_mode, 1);
+
+		if (storage_mode != 0x10)
+			throw std::runtime_error("Unsupported storage mode");
+
+		// Read variant and sample counts
+		pgen_file.read(reinterpret_cast<char*>(&variant_count), 4);
+		pgen_file.read(reinterpret_cast<char*>(&sample_count), 4);
+
+		packed_words = packedWordCount(sample_count);
+		subset_sample_count = 0;
+		subset_words = 0;
+
+		// Get file size
+		pgen_file.seekg(0, std::ios::end);
+		file_size = pgen_file.tellg();
+		pgen_file.seekg(11); // Return to start of header control byte
+
+		readVariantIndex();
+	}
+
+	void readVariantIndex()
+	{
+		// Header control byte: bits 0-3 give the vrtype width and record length width,
+		// bits 4-5 the allele count width and bits 6-7 the provisional reference flag mode
+		uint8_t control;
+		pgen_file.read(reinterpret_cast<char*>(&control), 1);
+
+		const uint32_t length_code = control & 0x0f;
+
+		if (length_code > 7)
+			throw std::runtime_error("Unsupported PGEN header control byte");
+
+		const bool wide_vrtypes = length_code >= 4;
+		const uint32_t record_length_bytes = wide_vrtypes ? length_code - 3 : length_code + 1;
+		const uint32_t allele_count_bytes = (control >> 4) & 3;
+		const bool explicit_nonref_flags = (control >> 6) == 3;
+
+		const uint32_t block_count = (variant_count + variant_block_size - 1) / variant_block_size;
+
+		std::vector<uint64_t> block_offsets(block_count);
+		pgen_file.read(reinterpret_cast<char*>(block_offsets.data()), 8 * static_cast<std::streamsize>(block_count));
+
+		vrtypes.resize(variant_count);
+		variant_offsets.resize(static_cast<size_t>(variant_count) + 1);
+
+		std::vector<uint8_t> block_index;
+
+		for (uint32_t block = 0; block < block_count; ++block)
+		{
+			const uint32_t first = block * variant_block_size;
+			const uint32_t count = std::min(variant_block_size, variant_count - first);
+
+			const uint32_t vrtype_bytes = wide_vrtypes ? count : (count + 1) / 2;
+			const uint32_t length_bytes = count * record_length_bytes;
+			const uint32_t trailing_bytes = count * allele_count_bytes + (explicit_nonref_flags ? (count + 7) / 8 : 0);
+
+			block_index.resize(vrtype_bytes + length_bytes);
+			pgen_file.read(reinterpret_cast<char*>(block_index.data()), block_index.size());
+			pgen_file.seekg(trailing_bytes, std::ios::cur);
+
+			if (!pgen_file)
+				throw std::runtime_error("Truncated PGEN variant index");
+
+			uint64_t offset = block_offsets[block];
+
+			for (uint32_t i = 0; i < count; ++i)
+			{
+				vrtypes[first + i] = wide_vrtypes ? block_index[i] : (block_index[i / 2] >> (4 * (i % 2))) & 0x0f;
+
+				uint64_t record_length = 0;
+				const uint8_t* length_ptr = &block_index[vrtype_bytes + i * record_length_bytes];
+
+				for (uint32_t b = 0; b < record_length_bytes; ++b)
+					record_length |= static_cast<uint64_t>(length_ptr[b]) << (8 * b);
+
+				variant_offsets[first + i] = offset;
+				offset += record_length;
+			}
+
+			variant_offsets[first + count] = offset;
+		}
+
+		if (variant_count && variant_offsets[variant_count] > file_size)
+			throw std::runtime_error("PGEN variant records extend past end of file");
+	}
+
+	static bool isLdCompressed(uint8_t vrtype)
+	{
+		return (vrtype & 6) == 2;
+	}
+
+	static uint32_t readVarint(const uint8_t*& ptr, const uint8_t* end)
+	{
+		uint32_t value = 0;
+
+		for (uint32_t shift = 0; shift < 32; shift += 7)
+		{
+			if (ptr == end)
+				throw std::runtime_error("Corrupt PGEN variant record");
+
+			const uint8_t byte = *ptr++;
+			value |= static_cast<uint32_t>(byte & 0x7f) << shift;
+
+			if (!(byte & 0x80))
+				return value;
+		}
+
+		throw std::runtime_error("Corrupt PGEN variant record");
+	}
+
+	// Bytes per difflist group start: enough to hold sample_count itself, as
+	// pgenlib sizes them (so 256 samples take 2 bytes)
+	uint32_t difflistSampleIdBytes() const
+	{
+		return sample_count < 0x100 ? 1 : sample_count < 0x10000 ? 2 : sample_count < 0x1000000 ? 3 : 4;
+	}
+
+	// Call fn(sample, genotype) for every entry of a difflist (sample IDs
+	// delta-coded in groups of 64) and leave ptr past its end
+	template <typename EntryFn>
+	void forEachDifflistEntry(const uint8_t*& ptr, const uint8_t* end, EntryFn fn) const
+	{
+		const uint32_t difflist_length = readVarint(ptr, end);
+
+		if (!difflist_length)
+			return;
+
+		const uint32_t group_count = (difflist_length + 63) / 64;
+		const uint32_t sample_id_bytes = difflistSampleIdBytes();
+
+		const uint8_t* group_starts = ptr;
+		const uint8_t* genotype_values = group_starts + group_count * (sample_id_bytes + 1) - 1;
+		ptr = genotype_values + (difflist_length + 3) / 4;
+
+		if (ptr > end)
+			throw std::runtime_error("Corrupt PGEN variant record");
+
+		uint32_t entry = 0;
+
+		for (uint32_t group = 0; group < group_count; ++group)
+		{
+			uint32_t sample = 0;
+
+			for (uint32_t b = 0; b < sample_id_bytes; ++b)
+				sample |= static_cast<uint32_t>(group_starts[group * sample_id_bytes + b]) << (8 * b);
+
+			const uint32_t group_end = std::min(entry + 64, difflist_length);
+
+			for (; entry < group_end; ++entry)
+			{
+				if (entry % 64)
+					sample += readVarint(ptr, end);
+
+				if (sample >= sample_count)
+					throw std::runtime_error("Corrupt PGEN variant record");
+
+				fn(sample, static_cast<uint8_t>((genotype_values[entry / 4] >> (2 * (entry % 4))) & 3));
+			}
+		}
+	}
+
+	// Overwrite the genotypes listed in a difflist. With a subset, entries for
+	// excluded samples are skipped and the rest land at their compacted positions.
+	void applyDifflist(const uint8_t*& ptr, const uint8_t* end, uint64_t* packed, bool subset) const
+	{
+		forEachDifflistEntry(ptr, end, [&](uint32_t sample, uint8_t genotype)
+			{
+				if (!subset)
+					setPackedGenotype(packed, sample, genotype);
+				else if (subset_positions[sample] != excluded_sample)
+					setPackedGenotype(packed, subset_positions[sample], genotype);
+			});
+	}
+
+	// Genotype counts of a record stored as a difflist against one common genotype
+	// (vrtype 4-7), read from the difflist values without placing any of them
+	GenotypeCounts countDifflistRecord(const uint8_t* ptr, const uint8_t* end, uint8_t vrtype) const
+	{
+		uint32_t by_genotype[4] = { 0, 0, 0, 0 };
+		const uint32_t difflist_length = readVarint(ptr, end);
+
+		if (difflist_length)
+		{
+			const uint32_t group_count = (difflist_length + 63) / 64;
+			const uint32_t sample_id_bytes = difflistSampleIdBytes();
+			const uint8_t* genotype_values = ptr + group_count * (sample_id_bytes + 1) - 1;
+
+			if (genotype_values + (difflist_length + 3) / 4 > end)
+				throw std::runtime_error("Corrupt PGEN variant record");
+
+			for (uint32_t entry = 0; entry < difflist_length; ++entry)
+				by_genotype[(genotype_values[entry / 4] >> (2 * (entry % 4))) & 3]++;
+		}
+
+		by_genotype[vrtype & 3] += sample_count - difflist_length;
+
+		GenotypeCounts counts = { by_genotype[0], by_genotype[1], by_genotype[2], by_genotype[3] };
+		return counts;
+	}
+
+	// Decode one record into a packed row, either over all samples or, with subset
+	// set, directly into the compacted layout of the registered sample subset
+	void decodeRecord(const uint8_t* ptr, const uint8_t* end, uint8_t vrtype, const uint64_t* ld_base, uint64_t* packed, bool subset) const
+	{
+		const uint32_t out_samples = subset ? subset_sample_count : sample_count;
+		const uint32_t out_words = subset ? subset_words : packed_words;
+
+		switch (vrtype & 7)
+		{
+		case 0:
+		{
+			// Plain 2-bit array
+			const uint32_t bytes = (sample_count + 3) / 4;
+
+			if (static_cast<uint64_t>(end - ptr) < bytes)
+				throw std::runtime_error("Corrupt PGEN variant record");
+
+			if (!subset)
+			{
+				std::memcpy(packed, ptr, bytes);
+				std::memset(reinterpret_cast<uint8_t*>(packed) + bytes, 0, static_cast<size_t>(packed_words) * 8 - bytes);
+				clearPackedPadding(packed, sample_count);
+				break;
+			}
+
+			std::memset(packed, 0, static_cast<size_t>(out_words) * 8);
+			PackedRowWriter writer(packed);
+
+			for (uint32_t word = 0; word < packed_words; ++word)
+			{
+				const uint32_t include = sampleMaskChunk(subset_mask.data(), word);
+
+				if (!include)
+					continue;
+
+				uint64_t fields = 0;
+				std::memcpy(&fields, ptr + 8 * word, std::min(8u, bytes - 8 * word));
+				writer.append(extractBits(fields, spreadBits(include) * 3), 2 * popcount64(include));
+			}
+			break;
+		}
+		case 1:
+		{
+			// 1-bit array choosing between two common genotypes, followed by a difflist
+			const uint32_t bytes = (sample_count + 7) / 8;
+
+			if (static_cast<uint64_t>(end - ptr) < bytes + 1u)
+				throw std::runtime_error("Corrupt PGEN variant record");
+
+			const uint8_t common_code = *ptr++;
+			const uint64_t low_word = (common_code / 4) * kMask5555;
+			const uint64_t delta = common_code & 3;
+
+			if (!subset)
+			{
+				for (uint32_t word = 0; word < packed_words; ++word)
+				{
+					uint32_t bits = 0;
+					std::memcpy(&bits, ptr + 4 * word, std::min(4u, bytes - 4 * word));
+					packed[word] = low_word + delta * spreadBits(bits);
+				}
+			}
+			else
+			{
+				std::memset(packed, 0, static_cast<size_t>(out_words) * 8);
+				PackedRowWriter writer(packed);
+
+				for (uint32_t word = 0; word < packed_words; ++word)
+				{
+					const uint32_t include = sampleMaskChunk(subset_mask.data(), word);
+
+					if (!include)
+						continue;
+
+					uint32_t bits = 0;
+					std::memcpy(&bits, ptr + 4 * word, std::min(4u, bytes - 4 * word));
+					writer.append(low_word + delta * spreadBits(extractBits(bits, include)), 2 * popcount64(include));
+				}
+			}
+
+			ptr += bytes;
+			clearPackedPadding(packed, out_samples);
+			applyDifflist(ptr, end, packed, subset);
+			break;
+		}
+		case 2:
+		case 3:
+		{
+			// Difflist against the most recent non-LD-compressed variant; type 3 also swaps alleles
+			std::memcpy(packed, ld_base, static_cast<size_t>(out_words) * 8);
+			applyDifflist(ptr, end, packed, subset);
+
+			if (vrtype & 1)
+			{
+				for (uint32_t word = 0; word < out_words; ++word)
+					packed[word] = invertGenotypeWord(packed[word]);
+
+				clearPackedPadding(packed, out_samples);
+			}
+			break;
+		}
+		default:
+		{
+			// Difflist against a single common genotype (vrtype & 3)
+			const uint64_t fill = (vrtype & 3) * kMask5555;
+
+			for (uint32_t word = 0; word < out_words; ++word)
+				packed[word] = fill;
+
+			clearPackedPadding(packed, out_samples);
+			applyDifflist(ptr, end, packed, subset);
+			break;
+		}
+		}
+	}
+
+	void readRecords(uint32_t start_variant, uint32_t end_variant)
+	{
+		const uint64_t start_pos = variant_offsets[start_variant];
+		const uint64_t bytes_to_read = variant_offsets[end_variant] - start_pos;
+
+		record_buffer.resize(bytes_to_read);
+		pgen_file.clear();
+		pgen_file.seekg(start_pos);
+		pgen_file.read(reinterpret_cast<char*>(record_buffer.data()), bytes_to_read);
+
+		if (!pgen_file)
+			throw std::runtime_error("Failed to read PGEN variant records");
+	}
+
+	static size_t columnIndex(const std::vector<std::string>& columns, const std::string& name)
+	{
+		auto it = std::find(columns.begin(), columns.end(), name);
+
+		if (it == columns.end())
+			throw std::runtime_error("Column " + name + " not found");
+
+		return it - columns.begin();
+	}
+
+	// Walk a .pvar/.psam table from the top: "##" lines are skipped, a "#" line
+	// names the columns (default_columns otherwise) and is passed to on_header,
+	// then every data line is split on whitespace and passed to on_row. Rows are
+	// skipped entirely when on_header returns false.
+	template <typename HeaderFn, typename RowFn>
+	void forEachTableRow(std::ifstream& file, const std::vector<std::string>& default_columns, HeaderFn on_header, RowFn on_row)
+	{
+		file.clear();
+		file.seekg(0);
+
+		std::string line;
+		std::vector<std::string> fields;
+		bool header_done = false;
+
+		while (std::getline(file, line))
+		{
+			if (!line.empty() && line.back() == '\r')
+				line.pop_back();
+
+			if (line.empty() || line.compare(0, 2, "##") == 0)
+				continue;
+
+			if (!header_done)
+			{
+				header_done = true;
+
+				bool read_rows;
+
+				if (line[0] == '#')
+				{
+					splitFields(line.substr(1), fields);
+					read_rows = on_header(fields);
+				}
+				else
+					read_rows = on_header(default_columns);
+
+				if (!read_rows)
+					break;
+
+				if (line[0] == '#')
+					continue;
+			}
+
+			splitFields(line, fields);
+
+			if (fields.empty())
+				continue;
+
+			on_row(fields);
+		}
+
+		file.clear();
+	}
+
+	static void splitFields(const std::string& line, std::vector<std::string>& fields)
+	{
+		fields.clear();
+		size_t pos = 0;
+
+		while (pos < line.size())
+		{
+			const size_t start = line.find_first_not_of(" \t", pos);
+
+			if (start == std::string::npos)
+				break;
+
+			pos = line.find_first_of(" \t", start);
+
+			if (pos == std::string::npos)
+				pos = line.size();
+
+			fields.push_back(line.substr(start, pos - start));
+		}
+	}
+
+public:
+	// Variant whose genotypes an LD-compressed record is stored relative to
+	uint32_t ldBase(uint32_t variant) const
+	{
+		while (isLdCompressed(vrtypes[variant]))
+		{
+			if (variant == 0)
+				throw std::runtime_error("LD-compressed PGEN record without a base variant");
+
+			--variant;
+		}
+
+		return variant;
+	}
+
+	// Hash of the variant index (every record's type and offset) and of every
+	// record byte, read sequentially in 1 MiB pieces. Any change to the
+	// genotypes changes it, so sidecars can tell a rewritten .pgen of the same
+	// size from their source; it costs one read of the file.
+	uint64_t contentChecksum()
+	{
+		uint64_t hash = 0xcbf29ce484222325ULL;
+
+		// FNV-1a style over 64-bit words: each step is a bijection of the
+		// word, so a single changed word always changes the result
+		auto add = [&](const void* data, size_t bytes)
+		{
+			const uint8_t* p = static_cast<const uint8_t*>(data);
+			size_t i = 0;
+
+			for (; i + 8 <= bytes; i += 8)
+			{
+				uint64_t word;
+				std::memcpy(&word, p + i, 8);
+				hash = (hash ^ word) * 0x100000001b3ULL;
+			}
+
+			for (; i < bytes; ++i)
+				hash = (hash ^ p[i]) * 0x100000001b3ULL;
+		};
+
+		add(vrtypes.data(), vrtypes.size());
+		add(variant_offsets.data(), variant_offsets.size() * sizeof(uint64_t));
+
+		if (!variant_count)
+			return hash;
+
+		const uint64_t piece = 1 << 20;
+		const uint64_t last = variant_offsets[variant_count];
+
+		std::lock_guard<std::mutex> lock(decode_mutex);
+		std::vector<uint8_t> bytes;
+
+		pgen_file.clear();
+		pgen_file.seekg(variant_offsets[0]);
+
+		for (uint64_t offset = variant_offsets[0]; offset < last; offset += bytes.size())
+		{
+			bytes.resize(std::min(piece, last - offset));
+			pgen_file.read(reinterpret_cast<char*>(bytes.data()), static_cast<std::streamsize>(bytes.size()));
+
+			if (!pgen_file)
+				throw std::runtime_error("Failed to read PGEN variant records");
+
+			add(bytes.data(), bytes.size());
+		}
+
+		return hash;
+	}
+
+	uint8_t variantRecordType(uint32_t variant) const
+	{
+		return vrtypes[variant];
+	}
+
+	// Decode variants [start_variant, end_variant) into packed 2-bit rows of
+	// packed_words words each, one seek and read per call (or per run of
+	// uncached blocks when the block cache is enabled)
+	void readPackedVariants(std::vector<uint64_t>& packed, uint32_t start_variant, uint32_t end_variant)
+	{
+		if (start_variant > end_variant || end_variant > variant_count)
+			throw std::out_of_range("Requested chunk is out of range");
+
+		packed.resize(static_cast<size_t>(end_variant - start_variant) * packed_words);
+
+		if (start_variant == end_variant)
+			return;
+
+		if (block_cache)
+			readCachedVariants(packed.data(), start_variant, end_variant);
+		else
+			decodeVariants(packed.data(), start_variant, end_variant);
+	}
+
+	// Hardcall counts of variants [start_variant, end_variant) over all samples.
+	// Difflist records are counted from their difflist values; the rest are
+	// decoded one at a time into scratch rows and popcounted.
+	void readVariantCounts(std::vector<GenotypeCounts>& counts, uint32_t start_variant, uint32_t end_variant)
+	{
+		if (start_variant > end_variant || end_variant > variant_count)
+			throw std::out_of_range("Requested chunk is out of range");
+
+		counts.resize(end_variant - start_variant);
+
+		if (start_variant == end_variant)
+			return;
+
+		std::lock_guard<std::mutex> lock(decode_mutex);
+
+		std::vector<uint64_t> rows(2 * static_cast<size_t>(packed_words));
+		uint64_t* base = rows.data();
+		uint64_t* row = rows.data() + packed_words;
+		const uint64_t* ld_base = nullptr;
+
+		if (isLdCompressed(vrtypes[start_variant]))
+		{
+			const uint32_t first = ldBase(start_variant);
+
+			readRecords(first, first + 1);
+			decodeRecord(record_buffer.data(), record_buffer.data() + record_buffer.size(), vrtypes[first], nullptr, base, false);
+			ld_base = base;
+		}
+
+		readRecords(start_variant, end_variant);
+
+		const uint64_t buffer_start = variant_offsets[start_variant];
+
+		for (uint32_t variant = start_variant; variant < end_variant; ++variant)
+		{
+			const uint8_t vrtype = vrtypes[variant];
+			const uint8_t* record = record_buffer.data() + (variant_offsets[variant] - buffer_start);
+			const uint8_t* record_end = record_buffer.data() + (variant_offsets[variant + 1] - buffer_start);
+			const bool is_ld_base = variant + 1 < end_variant && isLdCompressed(vrtypes[variant + 1]);
+
+			if ((vrtype & 4) && !is_ld_base)
+			{
+				counts[variant - start_variant] = countDifflistRecord(record, record_end, vrtype);
+				continue;
+			}
+
+			decodeRecord(record, record_end, vrtype, ld_base, row, false);
+			counts[variant - start_variant] = countPackedGenotypes(row, packed_words, sample_count);
+
+			if (!isLdCompressed(vrtype))
+			{
+				std::swap(base, row);
+				ld_base = base;
+			}
+		}
+	}
+
+	// Variants [start_variant, end_variant) as the samples differing from a
+	// common genotype. Difflist records against one genotype are copied from
+	// their difflist without expanding a row; the rest are decoded one at a
+	// time into scratch rows and their non-hom-ref fields collected, so rare
+	// variants cost about their carrier count either way.
+	void readSparseVariants(std::vector<SparseVariant>& sparse, uint32_t start_variant, uint32_t end_variant)
+	{
+		if (start_variant > end_variant || end_variant > variant_count)
+			throw std::out_of_range("Requested chunk is out of range");
+
+		sparse.resize(end_variant - start_variant);
+
+		if (start_variant == end_variant)
+			return;
+
+		std::lock_guard<std::mutex> lock(decode_mutex);
+
+		std::vector<uint64_t> rows(2 * static_cast<size_t>(packed_words));
+		uint64_t* base = rows.data();
+		uint64_t* row = rows.data() + packed_words;
+		const uint64_t* ld_base = nullptr;
+
+		if (isLdCompressed(vrtypes[start_variant]))
+		{
+			const uint32_t first = ldBase(start_variant);
+
+			readRecords(first, first + 1);
+			decodeRecord(record_buffer.data(), record_buffer.data() + record_buffer.size(), vrtypes[first], nullptr, base, false);
+			ld_base = base;
+		}
+
+		readRecords(start_variant, end_variant);
+
+		const uint64_t buffer_start = variant_offsets[start_variant];
+
+		for (uint32_t variant = start_variant; variant < end_variant; ++variant)
+		{
+			const uint8_t vrtype = vrtypes[variant];
+			const uint8_t* record = record_buffer.data() + (variant_offsets[variant] - buffer_start);
+			const uint8_t* record_end = record_buffer.data() + (variant_offsets[variant + 1] - buffer_start);
+			const bool is_ld_base = variant + 1 < end_variant && isLdCompressed(vrtypes[variant + 1]);
+			SparseVariant& out = sparse[variant - start_variant];
+
+			out.samples.clear();
+			out.genotypes.clear();
+
+			if ((vrtype & 4) && !is_ld_base)
+			{
+				out.common = vrtype & 3;
+				forEachDifflistEntry(record, record_end, [&](uint32_t sample, uint8_t genotype)
+					{
+						out.samples.push_back(sample);
+						out.genotypes.push_back(genotype);
+					});
+				continue;
+			}
+
+			decodeRecord(record, record_end, vrtype, ld_base, row, false);
+			out.common = 0;
+
+			for (uint32_t word = 0; word < packed_words; ++word)
+			{
+				const uint64_t fields = row[word];
+
+				for (uint64_t nonzero = (fields | (fields >> 1)) & kMask5555; nonzero; nonzero &= nonzero - 1)
+				{
+					const uint32_t bit = static_cast<uint32_t>(__builtin_ctzll(nonzero));
+
+					out.samples.push_back(word * kGenotypesPerWord + bit / 2);
+					out.genotypes.push_back(static_cast<uint8_t>((fields >> bit) & 3));
+				}
+			}
+
+			if (!isLdCompressed(vrtype))
+			{
+				std::swap(base, row);
+				ld_base = base;
+			}
+		}
+	}
+
+	// Sample-major packed rows for variants [start_variant, end_variant): row s
+	// holds sample s's genotypes, packedWordCount(end_variant - start_variant) words
+	void readSampleMajorVariants(std::vector<uint64_t>& sample_major, uint32_t start_variant, uint32_t end_variant)
+	{
+		std::vector<uint64_t> packed;
+		readPackedVariants(packed, start_variant, end_variant);
+
+		transposePackedGenotypes(packed.data(), end_variant - start_variant, sample_count, sample_major);
+	}
+
+	// Keep up to byte_budget bytes of decoded blocks of block_variants variants in
+	// an LRU cache split over shard_count independently locked shards
+	void enableBlockCache(uint64_t byte_budget, uint32_t block_variants = 256, uint32_t shard_count = 16)
+	{
+		block_cache.reset(new DecodedBlockCache(byte_budget, block_variants, shard_count));
+	}
+
+	void disableBlockCache()
+	{
+		block_cache.reset();
+	}
+
+	BlockCacheStats blockCacheStats()
+	{
+		if (!block_cache)
+			return BlockCacheStats{ 0, 0, 0, 0, 0 };
+
+		return block_cache->stats();
+	}
+
+	// Decode [start_variant, end_variant) but keep only variants passing filter:
+	// packed receives their rows back to back and kept_variants their indices.
+	// Counts come from popcounts on packed rows, or from the difflist alone for
+	// single-genotype difflist records, so rejected variants are never expanded.
+	void readFilteredVariants(std::vector<uint64_t>& packed, std::vector<uint32_t>& kept_variants, uint32_t start_variant, uint32_t end_variant, const VariantFilter& filter)
+	{
+		if (start_variant > end_variant || end_variant > variant_count)
+			throw std::out_of_range("Requested chunk is out of range");
+
+		kept_variants.clear();
+		packed.resize(static_cast<size_t>(end_variant - start_variant) * packed_words);
+
+		if (start_variant == end_variant)
+			return;
+
+		uint32_t kept = 0;
+
+		if (block_cache)
+		{
+			readCachedVariants(packed.data(), start_variant, end_variant);
+
+			for (uint32_t variant = start_variant; variant < end_variant; ++variant)
+			{
+				const uint64_t* row = &packed[static_cast<size_t>(variant - start_variant) * packed_words];
+
+				if (!filter.passes(countPackedGenotypes(row, packed_words, sample_count), sample_count))
+					continue;
+
+				if (variant - start_variant != kept)
+					std::memcpy(&packed[static_cast<size_t>(kept) * packed_words], row, static_cast<size_t>(packed_words) * 8);
+
+				kept_variants.push_back(variant);
+				kept++;
+			}
+		}
+		else
+			kept = decodeFilteredVariants(packed.data(), kept_variants, start_variant, end_variant, filter);
+
+		packed.resize(static_cast<size_t>(kept) * packed_words);
+	}
+
+	// [sample][kept variant] ints for the variants passing filter
+	void readFilteredGenotypes(std::vector<std::vector<int>>& genotypes, std::vector<uint32_t>& kept_variants, uint32_t start_variant, uint32_t end_variant, const VariantFilter& filter)
+	{
+		std::vector<uint64_t> packed;
+		readFilteredVariants(packed, kept_variants, start_variant, end_variant, filter);
+
+		unpackGenotypeTile(packed.data(), packed_words, static_cast<uint32_t>(kept_variants.size()), 0, sample_count, genotypes);
+	}
+
+	// Register the samples to decode in subset reads: bit i of include_mask
+	// (64 samples per word) selects sample i
+	void setSampleSubset(const std::vector<uint64_t>& include_mask)
+	{
+		if (include_mask.size() < (static_cast<size_t>(sample_count) + 63) / 64)
+			throw std::invalid_argument("Sample mask is smaller than the sample count");
+
+		subset_mask.assign(include_mask.begin(), include_mask.begin() + (sample_count + 63) / 64);
+
+		if (sample_count % 64)
+			subset_mask.back() &= (1ULL << (sample_count % 64)) - 1;
+
+		subset_positions.assign(sample_count, excluded_sample);
+		subset_sample_count = 0;
+
+		for (uint32_t sample = 0; sample < sample_count; ++sample)
+		{
+			if ((subset_mask[sample / 64] >> (sample % 64)) & 1)
+				subset_positions[sample] = subset_sample_count++;
+		}
+
+		subset_words = packedWordCount(subset_sample_count);
+	}
+
+	void clearSampleSubset()
+	{
+		subset_mask.clear();
+		subset_positions.clear();
+		subset_sample_count = 0;
+		subset_words = 0;
+	}
+
+	// Like readPackedVariants, but rows hold only the registered subset
+	// (subset_words words each, samples in file order). Records are decoded
+	// straight into the compacted layout, never expanded to all samples.
+	void readPackedSubset(std::vector<uint64_t>& packed, uint32_t start_variant, uint32_t end_variant)
+	{
+		if (start_variant > end_variant || end_variant > variant_count)
+			throw std::out_of_range("Requested chunk is out of range");
+
+		if (subset_mask.empty())
+			throw std::logic_error("No sample subset registered");
+
+		packed.resize(static_cast<size_t>(end_variant - start_variant) * subset_words);
+
+		if (start_variant == end_variant)
+			return;
+
+		if (block_cache)
+		{
+			// Cached blocks hold every sample; compact them in memory
+			std::vector<uint64_t> full(static_cast<size_t>(end_variant - start_variant) * packed_words);
+			readCachedVariants(full.data(), start_variant, end_variant);
+
+			for (uint32_t variant = 0; variant < end_variant - start_variant; ++variant)
+				compactPackedRow(&full[static_cast<size_t>(variant) * packed_words], packed_words, subset_mask.data(), &packed[static_cast<size_t>(variant) * subset_words], subset_words);
+		}
+		else
+			decodeVariants(packed.data(), start_variant, end_variant, true);
+	}
+
+	// [subset sample][variant] ints for the registered subset (-1 for missing)
+	void readGenotypesSubset(std::vector<std::vector<int>>& genotypes, uint32_t start_variant, uint32_t end_variant)
+	{
+		std::vector<uint64_t> packed;
+		readPackedSubset(packed, start_variant, end_variant);
+
+		unpackGenotypeTile(packed.data(), subset_words, end_variant - start_variant, 0, subset_sample_count, genotypes);
+	}
+
+private:
+	void decodeVariants(uint64_t* packed, uint32_t start_variant, uint32_t end_variant, bool subset = false)
+	{
+		std::lock_guard<std::mutex> lock(decode_mutex);
+
+		const uint32_t row_words = subset ? subset_words : packed_words;
+		const uint64_t* ld_base = nullptr;
+
+		if (isLdCompressed(vrtypes[start_variant]))
+		{
+			// The chain starts before the requested range; decode its base first
+			const uint32_t base = ldBase(start_variant);
+
+			readRecords(base, base + 1);
+			ld_base_buffer.resize(row_words);
+			decodeRecord(record_buffer.data(), record_buffer.data() + record_buffer.size(), vrtypes[base], nullptr, ld_base_buffer.data(), subset);
+			ld_base = ld_base_buffer.data();
+		}
+
+		readRecords(start_variant, end_variant);
+
+		const uint64_t buffer_start = variant_offsets[start_variant];
+
+		for (uint32_t variant = start_variant; variant < end_variant; ++variant)
+		{
+			const uint8_t* record = record_buffer.data() + (variant_offsets[variant] - buffer_start);
+			const uint8_t* record_end = record_buffer.data() + (variant_offsets[variant + 1] - buffer_start);
+			uint64_t* row = packed + static_cast<size_t>(variant - start_variant) * row_words;
+
+			decodeRecord(record, record_end, vrtypes[variant], ld_base, row, subset);
+
+			if (!isLdCompressed(vrtypes[variant]))
+				ld_base = row;
+		}
+	}
+
+	// Returns the number of variants kept; their rows are packed to the front of packed
+	uint32_t decodeFilteredVariants(uint64_t* packed, std::vector<uint32_t>& kept_variants, uint32_t start_variant, uint32_t end_variant, const VariantFilter& filter)
+	{
+		std::lock_guard<std::mutex> lock(decode_mutex);
+
+		const uint64_t* ld_base = nullptr;
+		ld_base_buffer.resize(packed_words);
+
+		if (isLdCompressed(vrtypes[start_variant]))
+		{
+			const uint32_t base = ldBase(start_variant);
+
+			readRecords(base, base + 1);
+			decodeRecord(record_buffer.data(), record_buffer.data() + record_buffer.size(), vrtypes[base], nullptr, ld_base_buffer.data(), false);
+			ld_base = ld_base_buffer.data();
+		}
+
+		readRecords(start_variant, end_variant);
+
+		const uint64_t buffer_start = variant_offsets[start_variant];
+		uint32_t kept = 0;
+
+		for (uint32_t variant = start_variant; variant < end_variant; ++variant)
+		{
+			const uint8_t vrtype = vrtypes[variant];
+			const uint8_t* record = record_buffer.data() + (variant_offsets[variant] - buffer_start);
+			const uint8_t* record_end = record_buffer.data() + (variant_offsets[variant + 1] - buffer_start);
+			const bool is_ld_base = variant + 1 < end_variant && isLdCompressed(vrtypes[variant + 1]);
+
+			// Single-genotype difflist records can be rejected from their counts alone,
+			// unless a following LD-compressed record needs them decoded
+			if ((vrtype & 4) && !is_ld_base && !filter.passes(countDifflistRecord(record, record_end, vrtype), sample_count))
+				continue;
+
+			uint64_t* row = packed + static_cast<size_t>(kept) * packed_words;
+			decodeRecord(record, record_end, vrtype, ld_base, row, false);
+
+			const bool passes = filter.passes(countPackedGenotypes(row, packed_words, sample_count), sample_count);
+
+			if (!isLdCompressed(vrtype))
+			{
+				if (passes)
+					ld_base = row;
+				else
+				{
+					std::memcpy(ld_base_buffer.data(), row, static_cast<size_t>(packed_words) * 8);
+					ld_base = ld_base_buffer.data();
+				}
+			}
+
+			if (passes)
+			{
+				kept_variants.push_back(variant);
+				kept++;
+			}
+		}
+
+		return kept;
+	}
+
+	void readCachedVariants(uint64_t* packed, uint32_t start_variant, uint32_t end_variant)
+	{
+		const uint32_t block_variants = block_cache->block_variants;
+		const uint32_t first_block = start_variant / block_variants;
+		const uint32_t last_block = (end_variant - 1) / block_variants;
+
+		std::vector<DecodedBlock> blocks(last_block - first_block + 1);
+
+		for (uint32_t block = first_block; block <= last_block; ++block)
+			blocks[block - first_block] = block_cache->find(block);
+
+		// Decode each run of consecutive missing blocks with a single read
+		for (uint32_t block = first_block; block <= last_block; ++block)
+		{
+			if (blocks[block - first_block])
+				continue;
+
+			uint32_t run_end = block + 1;
+
+			while (run_end <= last_block && !blocks[run_end - first_block])
+				run_end++;
+
+			const uint32_t run_start_variant = block * block_variants;
+			const uint32_t run_end_variant = std::min(run_end * block_variants, variant_count);
+
+			std::vector<uint64_t> run(static_cast<size_t>(run_end_variant - run_start_variant) * packed_words);
+			decodeVariants(run.data(), run_start_variant, run_end_variant);
+
+			for (uint32_t b = block; b < run_end; ++b)
+			{
+				const size_t row_begin = static_cast<size_t>(b * block_variants - run_start_variant) * packed_words;
+				const size_t row_end = static_cast<size_t>(std::min((b + 1) * block_variants, variant_count) - run_start_variant) * packed_words;
+
+				DecodedBlock decoded = std::make_shared<const std::vector<uint64_t>>(run.begin() + row_begin, run.begin() + row_end);
+				block_cache->insert(b, decoded);
+				blocks[b - first_block] = decoded;
+			}
+
+			block = run_end - 1;
+		}
+
+		for (uint32_t block = first_block; block <= last_block; ++block)
+		{
+			const uint32_t block_start = block * block_variants;
+			const uint32_t copy_start = std::max(start_variant, block_start);
+			const uint32_t copy_end = std::min(end_variant, block_start + block_variants);
+
+			std::memcpy(
+				packed + static_cast<size_t>(copy_start - start_variant) * packed_words,
+				blocks[block - first_block]->data() + static_cast<size_t>(copy_start - block_start) * packed_words,
+				static_cast<size_t>(copy_end - copy_start) * packed_words * sizeof(uint64_t));
+		}
+	}
+
+public:
+	void readGenotypesChunk(std::vector<std::vector<int>>& genotypes, uint32_t start_variant, uint32_t end_variant, uint32_t start_sample, uint32_t end_sample)
+	{
+		if (start_variant > end_variant || end_variant > variant_count || start_sample > end_sample || end_sample > sample_count)
+			throw std::out_of_range("Requested chunk is out of range");
+
+		std::vector<uint64_t> packed;
+		readPackedVariants(packed, start_variant, end_variant);
+
+		unpackGenotypeTile(packed.data(), packed_words, end_variant - start_variant, start_sample, end_sample, genotypes);
+	}
+
+	// Every value of one .psam column by header name (e.g. "IID", "SEX", "PHENO1").
+	// A .psam without a header line is read with .fam columns.
+	void readSampleColumn(const std::string& column, std::vector<std::string>& values)
+	{
+		static const std::vector<std::string> fam_columns = { "FID", "IID", "PAT", "MAT", "SEX", "PHENO1" };
+
+		values.clear();
+		values.reserve(sample_count);
+
+		size_t index = 0;
+
+		forEachTableRow(psam_file, fam_columns,
+			[&](const std::vector<std::string>& columns)
+			{
+				index = columnIndex(columns, column);
+				return true;
+			},
+			[&](const std::vector<std::string>& fields)
+			{
+				if (index >= fields.size())
+					throw std::runtime_error("Malformed .psam line");
+
+				values.push_back(fields[index]);
+			});
+
+		if (values.size() != sample_count)
+			throw std::runtime_error("Sample count in .psam does not match the PGEN");
+	}
+
+	bool hasSampleColumn(const std::string& column)
+	{
+		static const std::vector<std::string> fam_columns = { "FID", "IID", "PAT", "MAT", "SEX", "PHENO1" };
+
+		bool found = false;
+
+		forEachTableRow(psam_file, fam_columns,
+			[&](const std::vector<std::string>& columns)
+			{
+				found = std::find(columns.begin(), columns.end(), column) != columns.end();
+				return false;
+			},
+			[](const std::vector<std::string>&) {});
+
+		return found;
+	}
+
+	void readSampleIds(std::vector<std::string>& sample_ids)
+	{
+		readSampleColumn("IID", sample_ids);
+	}
+
+	// SEX per sample: 1 male (1, M or m), 2 female (2, F or f), 0 unknown (no SEX
+	// column, or any other code)
+	void readSampleSexes(std::vector<uint8_t>& sexes)
+	{
+		sexes.assign(sample_count, 0);
+
+		if (!hasSampleColumn("SEX"))
+			return;
+
+		std::vector<std::string> values;
+		readSampleColumn("SEX", values);
+
+		for (uint32_t sample = 0; sample < sample_count; ++sample)
+		{
+			const std::string& value = values[sample];
+
+			if (value == "1" || value == "M" || value == "m")
+				sexes[sample] = 1;
+			else if (value == "2" || value == "F" || value == "f")
+				sexes[sample] = 2;
+		}
+	}
+
+	// CHROM, POS, ID, REF and ALT of every variant. A .pvar without a header
+	// line is read with .bim columns.
+	void readVariantInfo(std::vector<VariantInfo>& variants)
+	{
+		static const std::vector<std::string> bim_columns = { "CHROM", "ID", "CM", "POS", "ALT", "REF" };
+
+		variants.clear();
+		variants.reserve(variant_count);
+
+		size_t chrom = 0, pos = 0, id = 0, ref = 0, alt = 0, required = 0;
+
+		forEachTableRow(pvar_file, bim_columns,
+			[&](const std::vector<std::string>& columns)
+			{
+				chrom = columnIndex(columns, "CHROM");
+				pos = columnIndex(columns, "POS");
+				id = columnIndex(columns, "ID");
+				ref = columnIndex(columns, "REF");
+				alt = columnIndex(columns, "ALT");
+				required = std::max({ chrom, pos, id, ref, alt }) + 1;
+				return true;
+			},
+			[&](const std::vector<std::string>& fields)
+			{
+				if (fields.size() < required)
+					throw std::runtime_error("Malformed .pvar line");
+
+				VariantInfo info;
+				info.chrom = fields[chrom];
+				info.pos = static_cast<uint32_t>(std::stoul(fields[pos]));
+				info.id = fields[id];
+				info.ref = fields[ref];
+				info.alt = fields[alt];
+				variants.push_back(info);
+			});
+
+		if (variants.size() != variant_count)
+			throw std::runtime_error("Variant count in .pvar does not match the PGEN");
+	}
+
+	// IDs of variants [start_variant, end_variant), same half-open range as
+	// readGenotypesChunk; the .pvar is walked from the top on every call
+	void readVariantInfoChunk(std::vector<std::string>& variant_ids, uint32_t start_variant, uint32_t end_variant)
+	{
+		if (start_variant > end_variant || end_variant > variant_count)
+			throw std::out_of_range("Requested chunk is out of range");
+
+		std::vector<VariantInfo> variants;
+		readVariantInfo(variants);
+
+		variant_ids.clear();
+
+		for (uint32_t variant = start_variant; variant < end_variant; ++variant)
+			variant_ids.push_back(variants[variant].id);
+	}
+
+	// IIDs of samples [start_sample, end_sample), likewise half-open
+	void readSampleInfoChunk(std::vector<std::string>& sample_ids, uint32_t start_sample, uint32_t end_sample)
+	{
+		if (start_sample > end_sample || end_sample > sample_count)
+			throw std::out_of_range("Requested chunk is out of range");
+
+		std::vector<std::string> all_ids;
+		readSampleIds(all_ids);
+
+		sample_ids.assign(all_ids.begin() + start_sample, all_ids.begin() + end_sample);
+	}
+};
+
+struct GenotypeTile {
+	uint32_t start_variant;
+	uint32_t end_variant;
+	uint32_t start_sample;
+	uint32_t end_sample;
+
+	// [sample][variant], same layout as readGenotypesChunk
+	std::vector<std::vector<int>> genotypes;
+};
+
+// Walks the genotype matrix in variant blocks x sample tiles. Each variant
+// block is read and decoded once, then every sample tile of it is served from
+// the decoded block, so total I/O is one pass over the file.
+class Plink2TileIterator {
+private:
+	Plink2Reader& reader;
+	uint32_t variant_block_size;
+	uint32_t sample_tile_size;
+
+	uint32_t block_start;
+	uint32_t block_end;
+	uint32_t next_sample;
+
+	std::vector<uint64_t> block;
+
+public:
+	Plink2TileIterator(Plink2Reader& reader, uint32_t variant_block_size, uint32_t sample_tile_size)
+		: reader(reader),
+		variant_block_size(variant_block_size),
+		sample_tile_size(sample_tile_size),
+		block_start(0),
+		block_end(0),
+		next_sample(0)
+	{
+		if (variant_block_size == 0 || sample_tile_size == 0)
+			throw std::invalid_argument("Tile dimensions must be nonzero");
+	}
+
+	bool next(GenotypeTile& tile)
+	{
+		if (block_end == block_start || next_sample >= reader.sample_count)
+		{
+			if (block_end >= reader.variant_count)
+				return false;
+
+			block_start = block_end;
+			block_end = std::min(block_start + variant_block_size, reader.variant_count);
+			next_sample = 0;
+
+			reader.readPackedVariants(block, block_start, block_end);
+		}
+
+		tile.start_variant = block_start;
+		tile.end_variant = block_end;
+		tile.start_sample = next_sample;
+		tile.end_sample = std::min(next_sample + sample_tile_size, reader.sample_count);
+
+		unpackGenotypeTile(block.data(), reader.packed_words, block_end - block_start, tile.start_sample, tile.end_sample, tile.genotypes);
+
+		next_sample = tile.end_sample;
+		return true;
+	}
+
+	// Packed rows of the current variant block
+	const std::vector<uint64_t>& packedBlock() const
+	{
+		return block;
+	}
+};
+
+// Tab-separated "FID<tab>IID" labels in .psam order, or just IID when the
+// .psam has no FID column; returns whether FIDs are present
+inline bool readSampleLabels(Plink2Reader& reader, std::vector<std::string>& labels)
+{
+	reader.readSampleIds(labels);
+
+	if (!reader.hasSampleColumn("FID"))
+		return false;
+
+	std::vector<std::string> fids;
+	reader.readSampleColumn("FID", fids);
+
+	for (uint32_t sample = 0; sample < labels.size(); ++sample)
+		labels[sample] = fids[sample] + '\t' + labels[sample];
+
+	return true;
+}
+
+// FID/IID list in .psam order ("#IID" only when the .psam has no FID column)
+inline void writeSampleIdFile(Plink2Reader& reader, const std::string& path)
+{
+	std::vector<std::string> labels;
+	const bool has_fid = readSampleLabels(reader, labels);
+
+	std::ofstream out(path);
+
+	if (!out.is_open())
+		throw std::runtime_error("Failed to open " + path);
+
+	out << (has_fid ? "#FID\tIID\n" : "#IID\n");
+
+	for (const std::string& label : labels)
+		out << label << '\n';
+}
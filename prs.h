@@ -0,0 +1,371 @@
+#pragma once
+
+#include <fstream>
+#include <sstream>
+#include <vector>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <stdexcept>
+#include <cstdint>
+#include <algorithm>
+
+#include "plink2_reader.h"
+#include "parallel.h"
+#include "linear_algebra.h"
+#include "chrx.h"
+
+struct ScoreOptions {
+	uint32_t block_variants = 1024;
+	uint32_t thread_count = 1;
+};
+
+// Polygenic scores for any number of weight files in one pass over the
+// genotypes. Weights are joined to the .pvar by variant ID and allele and
+// held per variant as ALT-dosage weights for every score (a REF-allele weight
+// w becomes -w on ALT plus a constant 2w), so the scores are S = G W + offset
+// with G the samples x variants ALT dosage matrix. Each block's product is
+// accumulated sample-word by sample-word over the non-hom-ref fields only;
+// missing calls take the variant's mean dosage. On chromosome X male hets are
+// set missing through the sex masks, and a male hom alt counts as dosage 2.
+// Every file gets its own called-allele count over the variants it joined,
+// with a called male X genotype counted as one allele.
+class PolygenicScoreEngine {
+private:
+	Plink2Reader& reader;
+	ScoreOptions options;
+
+	std::vector<VariantInfo> variants;
+	std::unordered_map<std::string, uint32_t> variant_index;
+
+	// Joined variants in file order, and their weights (one row per joined
+	// variant) with the score files that gave them
+	std::vector<uint32_t> scored_variants;
+	std::unordered_map<uint32_t, uint32_t> weight_row;
+	std::vector<std::vector<double>> weight_rows;
+	std::vector<std::vector<uint32_t>> row_files;
+	std::vector<double> offsets;
+
+	// variant ID -> index, with duplicate IDs marked unusable
+	void indexVariants()
+	{
+		static const uint32_t duplicate = 0xffffffffu;
+
+		reader.readVariantInfo(variants);
+
+		for (uint32_t variant = 0; variant < variants.size(); ++variant)
+		{
+			auto inserted = variant_index.emplace(variants[variant].id, variant);
+
+			if (!inserted.second)
+				inserted.first->second = duplicate;
+		}
+	}
+
+public:
+	std::vector<std::string> score_names;
+	std::vector<std::string> file_names;
+
+	// Per-score join statistics
+	std::vector<uint32_t> matched_counts;
+	std::vector<uint32_t> skipped_counts;
+
+	// samples x scores, and samples x files: each sample's count of called
+	// alleles over the variants the file joined
+	Matrix scores;
+	std::vector<uint32_t> allele_counts;
+
+	PolygenicScoreEngine(Plink2Reader& reader, const ScoreOptions& options)
+		: reader(reader), options(options)
+	{
+		if (options.block_variants == 0)
+			throw std::invalid_argument("Score block size must be nonzero");
+
+		indexVariants();
+	}
+
+	// Whitespace-delimited: variant ID, effect allele, then one or more weight
+	// columns. A '#' header line names the weight columns; otherwise they are
+	// named <path>_1, <path>_2, ... Variants missing from the .pvar, with an
+	// ambiguous ID or with an allele that is neither REF nor ALT are skipped; a
+	// variant listed twice in one file (under either allele) is an error.
+	void addScoreFile(const std::string& path)
+	{
+		std::ifstream file(path);
+
+		if (!file.is_open())
+			throw std::runtime_error("Failed to open " + path);
+
+		const uint32_t first_score = static_cast<uint32_t>(score_names.size());
+		const uint32_t file_index = static_cast<uint32_t>(file_names.size());
+		uint32_t score_count = 0;
+
+		std::string line;
+		std::vector<std::string> fields;
+
+		// Variants this file has already given weights to
+		std::unordered_set<uint32_t> matched;
+
+		while (std::getline(file, line))
+		{
+			std::istringstream stream(line[0] == '#' ? line.substr(1) : line);
+			fields.clear();
+
+			for (std::string field; stream >> field; )
+				fields.push_back(field);
+
+			if (fields.empty())
+				continue;
+
+			if (!score_count)
+			{
+				if (fields.size() < 3)
+					throw std::runtime_error(path + " needs ID, allele and weight columns");
+
+				score_count = static_cast<uint32_t>(fields.size()) - 2;
+
+				for (uint32_t score = 0; score < score_count; ++score)
+					score_names.push_back(line[0] == '#' ? fields[score + 2] : path + "_" + std::to_string(score + 1));
+
+				offsets.resize(score_names.size(), 0.0);
+				matched_counts.resize(score_names.size(), 0);
+				skipped_counts.resize(score_names.size(), 0);
+
+				if (line[0] == '#')
+					continue;
+			}
+
+			if (fields.size() != score_count + 2)
+				throw std::runtime_error("Malformed line in " + path);
+
+			const auto it = variant_index.find(fields[0]);
+			const VariantInfo* info = it == variant_index.end() || it->second >= variants.size() ? nullptr : &variants[it->second];
+			const bool is_alt = info && fields[1] == info->alt;
+
+			if (!info || (!is_alt && fields[1] != info->ref))
+			{
+				for (uint32_t score = 0; score < score_count; ++score)
+					skipped_counts[first_score + score]++;
+
+				continue;
+			}
+
+			if (!matched.insert(it->second).second)
+				throw std::runtime_error("Variant " + fields[0] + " appears more than once in " + path);
+
+			auto row_it = weight_row.find(it->second);
+
+			if (row_it == weight_row.end())
+			{
+				row_it = weight_row.emplace(it->second, static_cast<uint32_t>(weight_rows.size())).first;
+				weight_rows.emplace_back();
+				row_files.emplace_back();
+			}
+
+			row_files[row_it->second].push_back(file_index);
+
+			std::vector<double>& weights = weight_rows[row_it->second];
+			weights.resize(score_names.size(), 0.0);
+
+			for (uint32_t score = 0; score < score_count; ++score)
+			{
+				const double weight = std::stod(fields[score + 2]);
+
+				if (is_alt)
+					weights[first_score + score] += weight;
+				else
+				{
+					weights[first_score + score] -= weight;
+					offsets[first_score + score] += 2.0 * weight;
+				}
+
+				matched_counts[first_score + score]++;
+			}
+		}
+
+		if (!score_count)
+			throw std::runtime_error(path + " has no weights");
+
+		file_names.push_back(path);
+	}
+
+	void compute()
+	{
+		const uint32_t sample_count = reader.sample_count;
+		const uint32_t words = reader.packed_words;
+		const uint32_t score_count = static_cast<uint32_t>(score_names.size());
+		const uint32_t file_count = static_cast<uint32_t>(file_names.size());
+
+		if (!score_count)
+			throw std::logic_error("No score files added");
+
+		// Dense weights in variant order
+		scored_variants.clear();
+
+		for (const auto& entry : weight_row)
+			scored_variants.push_back(entry.first);
+
+		std::sort(scored_variants.begin(), scored_variants.end());
+
+		Matrix weights(static_cast<uint32_t>(scored_variants.size()), score_count);
+		std::vector<const std::vector<uint32_t>*> files(scored_variants.size());
+
+		// Per file, the joined variants and those of them on chromosome X
+		std::vector<uint32_t> file_variants(file_count, 0);
+		std::vector<uint32_t> file_x_variants(file_count, 0);
+
+		for (uint32_t row = 0; row < scored_variants.size(); ++row)
+		{
+			const uint32_t source = weight_row[scored_variants[row]];
+			const bool is_x = isChromosomeX(variants[scored_variants[row]].chrom);
+
+			std::copy(weight_rows[source].begin(), weight_rows[source].end(), weights.row(row));
+			files[row] = &row_files[source];
+
+			for (uint32_t file : row_files[source])
+			{
+				file_variants[file]++;
+				file_x_variants[file] += is_x;
+			}
+		}
+
+		std::unique_ptr<SexMasks> masks;
+		std::vector<uint8_t> is_male(sample_count, 0);
+
+		if (std::any_of(file_x_variants.begin(), file_x_variants.end(), [](uint32_t count) { return count != 0; }))
+		{
+			masks.reset(new SexMasks(reader));
+
+			for (uint32_t sample = 0; sample < sample_count; ++sample)
+				is_male[sample] = masks->sexes[sample] == 1;
+		}
+
+		// Every call counted as present; missing calls are taken back off as they are met
+		scores = Matrix(sample_count, score_count);
+		allele_counts.resize(static_cast<size_t>(sample_count) * file_count);
+
+		for (uint32_t sample = 0; sample < sample_count; ++sample)
+		{
+			std::copy(offsets.begin(), offsets.end(), scores.row(sample));
+
+			for (uint32_t file = 0; file < file_count; ++file)
+				allele_counts[static_cast<size_t>(sample) * file_count + file] = 2 * file_variants[file] - (is_male[sample] ? file_x_variants[file] : 0);
+		}
+
+		std::vector<uint64_t> packed;
+		std::vector<uint32_t> block_rows;
+		std::vector<uint8_t> block_x;
+		std::vector<double> means;
+		size_t next = 0;
+
+		while (next < scored_variants.size())
+		{
+			// Decode the block holding the next joined variant
+			const uint32_t block_start = scored_variants[next] - scored_variants[next] % options.block_variants;
+			const uint32_t block_end = std::min(block_start + options.block_variants, reader.variant_count);
+
+			reader.readPackedVariants(packed, block_start, block_end);
+
+			block_rows.clear();
+			block_x.clear();
+			means.clear();
+
+			for (; next < scored_variants.size() && scored_variants[next] < block_end; ++next)
+			{
+				uint64_t* row = &packed[static_cast<size_t>(scored_variants[next] - block_start) * words];
+
+				const bool is_x = isChromosomeX(variants[scored_variants[next]].chrom);
+
+				if (is_x)
+					setMaleHetsMissing(row, masks->male.data(), words);
+
+				const GenotypeCounts counts = countPackedGenotypes(row, words, sample_count);
+				const uint32_t called = sample_count - counts.missing;
+
+				block_rows.push_back(static_cast<uint32_t>(next));
+				block_x.push_back(is_x);
+				means.push_back(called ? (counts.het + 2.0 * counts.hom_alt) / called : 0.0);
+			}
+
+			// One task per 32-sample word, so every task owns its rows of scores
+			parallelFor(words, options.thread_count,
+				[&](uint32_t word, uint32_t)
+				{
+					for (uint32_t i = 0; i < block_rows.size(); ++i)
+					{
+						const uint32_t row = block_rows[i];
+						const uint64_t fields = packed[static_cast<size_t>(scored_variants[row] - block_start) * words + word];
+						const double* weight = weights.row(row);
+						uint64_t nonzero = (fields | (fields >> 1)) & kMask5555;
+						uint64_t missing = fields & (fields >> 1) & kMask5555;
+
+						while (nonzero)
+						{
+							const uint32_t bit = static_cast<uint32_t>(__builtin_ctzll(nonzero));
+							const uint32_t code = static_cast<uint32_t>((fields >> bit) & 3);
+
+							addScaledRow(scores.row(word * kGenotypesPerWord + bit / 2), weight, code == 3 ? means[i] : code, score_count);
+
+							nonzero &= nonzero - 1;
+						}
+
+						for (; missing; missing &= missing - 1)
+						{
+							const uint32_t sample = word * kGenotypesPerWord + static_cast<uint32_t>(__builtin_ctzll(missing)) / 2;
+							const uint32_t alleles = block_x[i] && is_male[sample] ? 1 : 2;
+
+							for (uint32_t file : *files[row])
+								allele_counts[static_cast<size_t>(sample) * file_count + file] -= alleles;
+						}
+					}
+				});
+		}
+	}
+
+	uint32_t variantsScored() const
+	{
+		return static_cast<uint32_t>(scored_variants.size());
+	}
+
+	// <prefix>.sscore: sample IDs, called allele count (ALLELE_CT, or one
+	// <file>_ALLELE_CT per score file when there are several), then every
+	// score's sum
+	void write(const std::string& prefix)
+	{
+		std::vector<std::string> labels;
+		const bool has_fid = readSampleLabels(reader, labels);
+
+		std::ofstream out(prefix + ".sscore");
+
+		if (!out.is_open())
+			throw std::runtime_error("Failed to open " + prefix + ".sscore");
+
+		const uint32_t file_count = static_cast<uint32_t>(file_names.size());
+
+		out << (has_fid ? "#FID\tIID" : "#IID");
+
+		for (const std::string& file : file_names)
+			out << '\t' << (file_count == 1 ? "" : file + "_") << "ALLELE_CT";
+
+		for (const std::string& name : score_names)
+			out << '\t' << name << "_SUM";
+
+		out << '\n';
+
+		for (uint32_t sample = 0; sample < reader.sample_count; ++sample)
+		{
+			out << labels[sample];
+
+			for (uint32_t file = 0; file < file_count; ++file)
+				out << '\t' << allele_counts[static_cast<size_t>(sample) * file_count + file];
+
+			for (uint32_t score = 0; score < scores.cols; ++score)
+				out << '\t' << scores(sample, score);
+
+			out << '\n';
+		}
+
+		if (!out)
+			throw std::runtime_error("Failed to write " + prefix + ".sscore");
+	}
+};
@@ -0,0 +1,175 @@
+#pragma once
+
+#include <fstream>
+#include <vector>
+#include <string>
+#include <stdexcept>
+#include <cstdint>
+#include <cstring>
+#include <cstdio>
+#include <algorithm>
+
+#include "plink2_reader.h"
+
+// Sample-major companion file for a PGEN: every sample's genotypes across all
+// variants stored as one contiguous packed row, so a per-sample query is a
+// single read instead of a decode of every variant record.
+//
+// Layout (little-endian):
+//   bytes 0-3    magic "P2SM"
+//   bytes 4-7    format version (2)
+//   bytes 8-11   variant count
+//   bytes 12-15  sample count
+//   bytes 16-23  size in bytes of the source .pgen
+//   bytes 24-31  contentChecksum() of the source .pgen; with the size, detects
+//                stale sidecars
+//   then one row per sample of packedWordCount(variant count) 64-bit words,
+//   2-bit genotypes in variant order
+
+const char kSampleMajorMagic[4] = { 'P', '2', 'S', 'M' };
+const uint32_t kSampleMajorVersion = 2;
+const uint64_t kSampleMajorHeaderSize = 32;
+
+// Stream the PGEN in variant blocks sized to memory_budget bytes, transpose each
+// block in memory and write every sample's slice of it into place. The file is
+// built as path + ".tmp" and renamed over path only once fully written, so an
+// interrupted build never leaves a sidecar whose header passes checkMatches.
+inline void buildSampleMajorFile(Plink2Reader& reader, const std::string& path, uint64_t memory_budget)
+{
+	const uint32_t variant_count = reader.variant_count;
+	const uint32_t sample_count = reader.sample_count;
+	const uint32_t row_words = packedWordCount(variant_count);
+	const uint64_t row_bytes = static_cast<uint64_t>(row_words) * 8;
+
+	// A block needs its variant-major rows and their transpose, about
+	// sample_count / 4 bytes per variant each
+	const uint64_t bytes_per_variant = 2 * (static_cast<uint64_t>(reader.packed_words) * 8);
+	uint64_t block_variants = memory_budget / std::max<uint64_t>(bytes_per_variant, 1);
+	block_variants = std::max<uint64_t>(kGenotypesPerWord, block_variants / kGenotypesPerWord * kGenotypesPerWord);
+	block_variants = std::min<uint64_t>(block_variants, static_cast<uint64_t>(row_words) * kGenotypesPerWord);
+
+	const std::string temp_path = path + ".tmp";
+	std::ofstream out(temp_path, std::ios::binary | std::ios::trunc);
+
+	if (!out.is_open())
+		throw std::runtime_error("Failed to open sample-major file for writing");
+
+	out.write(kSampleMajorMagic, 4);
+	out.write(reinterpret_cast<const char*>(&kSampleMajorVersion), 4);
+	out.write(reinterpret_cast<const char*>(&variant_count), 4);
+	out.write(reinterpret_cast<const char*>(&sample_count), 4);
+	out.write(reinterpret_cast<const char*>(&reader.file_size), 8);
+
+	const uint64_t checksum = reader.contentChecksum();
+	out.write(reinterpret_cast<const char*>(&checksum), 8);
+
+	std::vector<uint64_t> packed;
+	std::vector<uint64_t> sample_major;
+
+	for (uint32_t block_start = 0; block_start < variant_count; block_start += static_cast<uint32_t>(block_variants))
+	{
+		const uint32_t block_end = static_cast<uint32_t>(std::min<uint64_t>(block_start + block_variants, variant_count));
+		const uint32_t block_words = packedWordCount(block_end - block_start);
+
+		reader.readPackedVariants(packed, block_start, block_end);
+		transposePackedGenotypes(packed.data(), block_end - block_start, sample_count, sample_major);
+
+		// block_start is a multiple of 32, so each slice starts on a word boundary
+		for (uint32_t sample = 0; sample < sample_count; ++sample)
+		{
+			out.seekp(kSampleMajorHeaderSize + sample * row_bytes + (block_start / kGenotypesPerWord) * 8);
+			out.write(reinterpret_cast<const char*>(&sample_major[static_cast<size_t>(sample) * block_words]), static_cast<std::streamsize>(block_words) * 8);
+		}
+	}
+
+	out.close();
+
+	if (!out)
+	{
+		std::remove(temp_path.c_str());
+		throw std::runtime_error("Failed to write sample-major file");
+	}
+
+	if (std::rename(temp_path.c_str(), path.c_str()) != 0)
+	{
+		std::remove(temp_path.c_str());
+		throw std::runtime_error("Failed to rename " + temp_path + " to " + path);
+	}
+}
+
+class SampleMajorReader {
+private:
+	std::ifstream file;
+
+public:
+	uint32_t variant_count;
+	uint32_t sample_count;
+	uint64_t pgen_size;
+	uint64_t pgen_checksum;
+
+	// Words per sample row
+	uint32_t row_words;
+
+	SampleMajorReader(const std::string& path)
+	{
+		file.open(path, std::ios::binary);
+
+		if (!file.is_open())
+			throw std::runtime_error("Failed to open sample-major file");
+
+		char magic[4];
+		uint32_t version;
+		file.read(magic, 4);
+		file.read(reinterpret_cast<char*>(&version), 4);
+		file.read(reinterpret_cast<char*>(&variant_count), 4);
+		file.read(reinterpret_cast<char*>(&sample_count), 4);
+		file.read(reinterpret_cast<char*>(&pgen_size), 8);
+		file.read(reinterpret_cast<char*>(&pgen_checksum), 8);
+
+		if (!file || std::memcmp(magic, kSampleMajorMagic, 4) != 0)
+			throw std::runtime_error("Invalid sample-major file");
+
+		if (version != kSampleMajorVersion)
+			throw std::runtime_error("Unsupported sample-major file version");
+
+		row_words = packedWordCount(variant_count);
+	}
+
+	// Throw if this sidecar was not built from the given PGEN
+	void checkMatches(Plink2Reader& reader) const
+	{
+		if (reader.variant_count != variant_count || reader.sample_count != sample_count || reader.file_size != pgen_size
+			|| reader.contentChecksum() != pgen_checksum)
+			throw std::runtime_error("Sample-major file does not match the PGEN; rebuild it");
+	}
+
+	// All of one sample's genotypes as a packed row, in one read
+	void readSample(std::vector<uint64_t>& row, uint32_t sample)
+	{
+		if (sample >= sample_count)
+			throw std::out_of_range("Requested sample is out of range");
+
+		row.resize(row_words);
+		file.clear();
+		file.seekg(kSampleMajorHeaderSize + static_cast<uint64_t>(sample) * row_words * 8);
+		file.read(reinterpret_cast<char*>(row.data()), static_cast<std::streamsize>(row_words) * 8);
+
+		if (!file)
+			throw std::runtime_error("Failed to read sample-major file");
+	}
+
+	// One sample's genotypes for every variant (-1 for missing)
+	void readSampleGenotypes(std::vector<int>& genotypes, uint32_t sample)
+	{
+		std::vector<uint64_t> row;
+		readSample(row, sample);
+
+		genotypes.resize(variant_count);
+
+		for (uint32_t variant = 0; variant < variant_count; ++variant)
+		{
+			const int genotype = getPackedGenotype(row.data(), variant);
+			genotypes[variant] = (genotype == 3) ? -1 : genotype;
+		}
+	}
+};
@@ -0,0 +1,311 @@
+#pragma once
+
+#include <fstream>
+#include <vector>
+#include <string>
+#include <stdexcept>
+#include <cstdint>
+#include <algorithm>
+#include <utility>
+
+#include "plink2_reader.h"
+#include "parallel.h"
+#include "ld.h"
+
+// Per-sample counters over rows of 64-sample mask words, held vertically:
+// plane b stores bit b of every sample's count, so adding a mask ripples a
+// carry through the planes at a few word operations per 64 samples. The planes
+// are flushed into 32-bit totals before they can overflow.
+class BitSlicedCounters {
+private:
+	static constexpr uint32_t kSliceBits = 8;
+	static constexpr uint32_t kMaxPending = (1u << kSliceBits) - 1;
+
+	uint32_t words;
+	uint32_t pending;
+	std::vector<uint64_t> planes;
+
+public:
+	// 64 entries per mask word; entries past the sample count are padding
+	std::vector<uint32_t> totals;
+
+	explicit BitSlicedCounters(uint32_t words)
+		: words(words), pending(0), planes(static_cast<size_t>(kSliceBits) * words, 0), totals(static_cast<size_t>(words) * 64, 0)
+	{
+	}
+
+	void add(const uint64_t* mask)
+	{
+		for (uint32_t word = 0; word < words; ++word)
+		{
+			uint64_t carry = mask[word];
+
+			for (uint32_t bit = 0; carry && bit < kSliceBits; ++bit)
+			{
+				uint64_t& plane = planes[static_cast<size_t>(bit) * words + word];
+				const uint64_t next = plane & carry;
+
+				plane ^= carry;
+				carry = next;
+			}
+		}
+
+		if (++pending == kMaxPending)
+			flush();
+	}
+
+	void flush()
+	{
+		for (uint32_t bit = 0; bit < kSliceBits; ++bit)
+		{
+			uint64_t* plane = &planes[static_cast<size_t>(bit) * words];
+
+			for (uint32_t word = 0; word < words; ++word)
+			{
+				for (uint64_t set = plane[word]; set; set &= set - 1)
+					totals[word * 64 + __builtin_ctzll(set)] += 1u << bit;
+
+				plane[word] = 0;
+			}
+		}
+
+		pending = 0;
+	}
+};
+
+// Chromosomes 1-22, with or without a "chr" prefix
+inline bool isAutosome(const std::string& chrom)
+{
+	const size_t start = chrom.compare(0, 3, "chr") == 0 ? 3 : 0;
+
+	if (chrom.size() <= start || chrom.size() > start + 2 || chrom[start] == '0')
+		return false;
+
+	if (!std::all_of(chrom.begin() + start, chrom.end(), [](char c) { return c >= '0' && c <= '9'; }))
+		return false;
+
+	return std::stoi(chrom.substr(start)) <= 22;
+}
+
+// [start, end) ranges of the autosomal variants
+inline std::vector<std::pair<uint32_t, uint32_t>> autosomeRanges(const std::vector<VariantInfo>& variants)
+{
+	std::vector<std::pair<uint32_t, uint32_t>> ranges;
+
+	for (const auto& range : chromosomeRanges(variants))
+	{
+		if (isAutosome(variants[range.first].chrom))
+			ranges.push_back(range);
+	}
+
+	return ranges;
+}
+
+struct SampleQcOptions {
+	uint32_t block_variants = 4096;
+	uint32_t thread_count = 1;
+
+	// [start, end) variant ranges to use; the autosomes when empty
+	std::vector<std::pair<uint32_t, uint32_t>> variant_ranges;
+};
+
+// Per-sample call rate, heterozygosity and inbreeding F over the autosomal
+// variants (or the option's variant ranges), as X, Y and MT calls of males
+// are not diploid and would bias F upward.
+// Blocks are split into bit planes and each thread adds its variants' het, hom
+// alt and missing masks to its own bit-sliced counters, which are summed at
+// the end. F = (O - E) / (N - E) over the sample's N called variants, with
+// E = sum of 1 - 2pq * 2n / (2n - 1) per variant; the missing calls' share of
+// E is taken back off sample by sample, as missing calls are sparse.
+class SampleQcEngine {
+private:
+	Plink2Reader& reader;
+	SampleQcOptions options;
+
+	struct Partial {
+		BitSlicedCounters het;
+		BitSlicedCounters hom_alt;
+		BitSlicedCounters missing;
+		std::vector<double> missing_expected;
+		double expected_hom;
+
+		explicit Partial(uint32_t plane_words)
+			: het(plane_words), hom_alt(plane_words), missing(plane_words), missing_expected(static_cast<size_t>(plane_words) * 64, 0.0), expected_hom(0.0)
+		{
+		}
+	};
+
+public:
+	std::vector<uint32_t> missing_counts;
+	std::vector<uint32_t> het_counts;
+	std::vector<uint32_t> hom_alt_counts;
+	std::vector<double> expected_hom;
+	uint32_t variants_used = 0;
+
+	SampleQcEngine(Plink2Reader& reader, const SampleQcOptions& options)
+		: reader(reader), options(options)
+	{
+		if (options.block_variants == 0)
+			throw std::invalid_argument("Sample QC block size must be nonzero");
+	}
+
+	void compute()
+	{
+		const uint32_t sample_count = reader.sample_count;
+		const uint32_t variant_count = reader.variant_count;
+		const uint32_t words = reader.packed_words;
+		const uint32_t plane_words = (sample_count + 63) / 64;
+		const uint32_t threads = std::max(1u, options.thread_count);
+		const uint32_t task_variants = 64;
+
+		std::vector<Partial> partials(threads, Partial(plane_words));
+		std::vector<std::vector<uint64_t>> scratch(threads, std::vector<uint64_t>(5 * static_cast<size_t>(plane_words)));
+		std::vector<uint64_t> packed;
+
+		std::vector<std::pair<uint32_t, uint32_t>> ranges = options.variant_ranges;
+
+		if (ranges.empty())
+		{
+			std::vector<VariantInfo> variants;
+			reader.readVariantInfo(variants);
+			ranges = autosomeRanges(variants);
+
+			if (ranges.empty())
+				throw std::runtime_error("No autosomal variants for sample QC");
+		}
+
+		// Blocks never straddle a range boundary
+		std::vector<std::pair<uint32_t, uint32_t>> blocks;
+
+		for (const auto& range : ranges)
+		{
+			if (range.first > range.second || range.second > variant_count)
+				throw std::out_of_range("Sample QC variant range is out of range");
+
+			for (uint32_t start = range.first; start < range.second; start += options.block_variants)
+				blocks.emplace_back(start, std::min(start + options.block_variants, range.second));
+		}
+
+		variants_used = 0;
+
+		for (const auto& block : blocks)
+		{
+			const uint32_t start = block.first;
+			const uint32_t end = block.second;
+			const uint32_t block_size = end - start;
+
+			variants_used += block_size;
+			reader.readPackedVariants(packed, start, end);
+
+			parallelFor((block_size + task_variants - 1) / task_variants, threads,
+				[&](uint32_t task, uint32_t thread_index)
+				{
+					Partial& partial = partials[thread_index];
+					uint64_t* low = scratch[thread_index].data();
+					uint64_t* high = low + plane_words;
+					uint64_t* het = high + plane_words;
+					uint64_t* hom_alt = het + plane_words;
+					uint64_t* missing = hom_alt + plane_words;
+
+					const uint32_t task_end = std::min((task + 1) * task_variants, block_size);
+
+					for (uint32_t offset = task * task_variants; offset < task_end; ++offset)
+					{
+						const uint64_t* row = &packed[static_cast<size_t>(offset) * words];
+						const GenotypeCounts counts = countPackedGenotypes(row, words, sample_count);
+						const uint32_t alleles = 2 * (sample_count - counts.missing);
+						const double p = altAlleleFrequency(counts);
+						const double expected = alleles > 1 ? 1.0 - 2.0 * p * (1.0 - p) * alleles / (alleles - 1.0) : 1.0;
+
+						splitBitPlanes(row, sample_count, low, high);
+
+						for (uint32_t word = 0; word < plane_words; ++word)
+						{
+							het[word] = low[word] & ~high[word];
+							hom_alt[word] = high[word] & ~low[word];
+							missing[word] = low[word] & high[word];
+						}
+
+						partial.het.add(het);
+						partial.hom_alt.add(hom_alt);
+						partial.expected_hom += expected;
+
+						if (!counts.missing)
+							continue;
+
+						partial.missing.add(missing);
+
+						for (uint32_t word = 0; word < plane_words; ++word)
+						{
+							for (uint64_t set = missing[word]; set; set &= set - 1)
+								partial.missing_expected[word * 64 + __builtin_ctzll(set)] += expected;
+						}
+					}
+				});
+		}
+
+		missing_counts.assign(sample_count, 0);
+		het_counts.assign(sample_count, 0);
+		hom_alt_counts.assign(sample_count, 0);
+		expected_hom.assign(sample_count, 0.0);
+
+		for (Partial& partial : partials)
+		{
+			partial.het.flush();
+			partial.hom_alt.flush();
+			partial.missing.flush();
+
+			for (uint32_t sample = 0; sample < sample_count; ++sample)
+			{
+				missing_counts[sample] += partial.missing.totals[sample];
+				het_counts[sample] += partial.het.totals[sample];
+				hom_alt_counts[sample] += partial.hom_alt.totals[sample];
+				expected_hom[sample] += partial.expected_hom - partial.missing_expected[sample];
+			}
+		}
+	}
+
+	// <prefix>.sqc: missing and called variant counts, call rate, hom alt and het
+	// counts, het rate, observed and expected homozygous counts and F
+	void write(const std::string& prefix)
+	{
+		compute();
+
+		std::vector<std::string> labels;
+		const bool has_fid = readSampleLabels(reader, labels);
+
+		std::ofstream out(prefix + ".sqc");
+
+		if (!out.is_open())
+			throw std::runtime_error("Failed to open " + prefix + ".sqc");
+
+		out << (has_fid ? "#FID\tIID" : "#IID") << "\tMISSING_CT\tOBS_CT\tCALL_RATE\tHOM_ALT_CT\tHET_CT\tHET_RATE\tO(HOM)\tE(HOM)\tF\n";
+
+		for (uint32_t sample = 0; sample < reader.sample_count; ++sample)
+		{
+			const uint32_t called = variants_used - missing_counts[sample];
+			const uint32_t observed_hom = called - het_counts[sample];
+
+			out << labels[sample] << '\t' << missing_counts[sample] << '\t' << called << '\t'
+				<< (variants_used ? static_cast<double>(called) / variants_used : 0.0) << '\t'
+				<< hom_alt_counts[sample] << '\t' << het_counts[sample] << '\t';
+
+			if (called)
+				out << static_cast<double>(het_counts[sample]) / called;
+			else
+				out << "NA";
+
+			out << '\t' << observed_hom << '\t' << expected_hom[sample] << '\t';
+
+			if (called > expected_hom[sample])
+				out << (observed_hom - expected_hom[sample]) / (called - expected_hom[sample]);
+			else
+				out << "NA";
+
+			out << '\n';
+		}
+
+		if (!out)
+			throw std::runtime_error("Failed to write " + prefix + ".sqc");
+	}
+};
@@ -0,0 +1,209 @@
+#pragma once
+
+#include <cmath>
+#include <limits>
+#include <cstdint>
+#include <algorithm>
+
+// Continued fraction for the regularized incomplete beta function (Lentz)
+inline double incompleteBetaFraction(double a, double b, double x)
+{
+	const double tiny = 1e-300;
+	double c = 1.0;
+	double d = 1.0 - (a + b) * x / (a + 1.0);
+	d = 1.0 / (std::fabs(d) < tiny ? tiny : d);
+	double result = d;
+
+	for (int m = 1; m <= 300; ++m)
+	{
+		for (int half = 0; half < 2; ++half)
+		{
+			const double numerator = half == 0
+				? m * (b - m) * x / ((a + 2.0 * m - 1.0) * (a + 2.0 * m))
+				: -(a + m) * (a + b + m) * x / ((a + 2.0 * m) * (a + 2.0 * m + 1.0));
+
+			d = 1.0 + numerator * d;
+			d = 1.0 / (std::fabs(d) < tiny ? tiny : d);
+			c = 1.0 + numerator / c;
+			c = std::fabs(c) < tiny ? tiny : c;
+			result *= c * d;
+
+			if (half == 1 && std::fabs(c * d - 1.0) < 1e-15)
+				return result;
+		}
+	}
+
+	return result;
+}
+
+// I_x(a, b)
+inline double regularizedIncompleteBeta(double a, double b, double x)
+{
+	if (x <= 0.0)
+		return 0.0;
+
+	if (x >= 1.0)
+		return 1.0;
+
+	const double front = std::exp(std::lgamma(a + b) - std::lgamma(a) - std::lgamma(b) + a * std::log(x) + b * std::log1p(-x));
+
+	// The fraction converges fast only below the mean; use the symmetry otherwise
+	if (x < (a + 1.0) / (a + b + 2.0))
+		return front * incompleteBetaFraction(a, b, x) / a;
+
+	return 1.0 - front * incompleteBetaFraction(b, a, 1.0 - x) / b;
+}
+
+// Q(a, x) = Gamma(a, x) / Gamma(a), upper regularized incomplete gamma
+inline double upperIncompleteGamma(double a, double x)
+{
+	if (x <= 0.0)
+		return 1.0;
+
+	const double front = std::exp(a * std::log(x) - x - std::lgamma(a));
+
+	if (x < a + 1.0)
+	{
+		// Series for P(a, x)
+		double term = 1.0 / a;
+		double sum = term;
+
+		for (int n = 1; n <= 1000 && std::fabs(term) > std::fabs(sum) * 1e-16; ++n)
+		{
+			term *= x / (a + n);
+			sum += term;
+		}
+
+		return 1.0 - front * sum;
+	}
+
+	// Continued fraction for Q(a, x) (Lentz)
+	const double tiny = 1e-300;
+	double b = x + 1.0 - a;
+	double c = 1.0 / tiny;
+	double d = 1.0 / b;
+	double result = d;
+
+	for (int n = 1; n <= 1000; ++n)
+	{
+		const double numerator = -n * (n - a);
+		b += 2.0;
+		d = numerator * d + b;
+		d = 1.0 / (std::fabs(d) < tiny ? tiny : d);
+		c = b + numerator / c;
+		c = std::fabs(c) < tiny ? tiny : c;
+		result *= c * d;
+
+		if (std::fabs(c * d - 1.0) < 1e-15)
+			break;
+	}
+
+	return front * result;
+}
+
+// Upper tail of the chi-square distribution
+inline double chiSquarePValue(double statistic, double degrees_of_freedom)
+{
+	if (!(statistic > 0.0))
+		return 1.0;
+
+	return upperIncompleteGamma(degrees_of_freedom / 2.0, statistic / 2.0);
+}
+
+// Two-sided p-value of a Student t statistic
+inline double studentTPValue(double t, double degrees_of_freedom)
+{
+	if (std::isnan(t))
+		return std::numeric_limits<double>::quiet_NaN();
+
+	return regularizedIncompleteBeta(degrees_of_freedom / 2.0, 0.5, degrees_of_freedom / (degrees_of_freedom + t * t));
+}
+
+// Two-sided p-value of a standard normal statistic
+inline double normalPValue(double z)
+{
+	return std::erfc(std::fabs(z) / std::sqrt(2.0));
+}
+
+// Hardy-Weinberg exact test (Wigginton et al. 2005) from genotype counts. The
+// het-count probabilities follow a two-term recurrence, so they are walked
+// outward from the observed count in units of its probability and each
+// direction stops once its terms are negligible next to the observed one;
+// the cost depends on the spread of the distribution rather than on the
+// sample size. With mid_p half of the observed probability is left out.
+inline double hweExactPValue(uint32_t het, uint32_t hom1, uint32_t hom2, bool mid_p = false)
+{
+	const double tie = 1.0 + 1e-7;
+	const double negligible = 1e-20;
+	const double rescale = 1e-250;
+
+	double observed = 1.0;
+	double tail = 1.0;
+	double total = 1.0;
+
+	// Towards more hets: each step takes one of each homozygote
+	double term = 1.0;
+	double hets = het;
+	double rare = std::min(hom1, hom2);
+	double common = std::max(hom1, hom2);
+
+	while (rare > 0.0)
+	{
+		term *= 4.0 * rare * common / ((hets + 2.0) * (hets + 1.0));
+		hets += 2.0;
+		rare -= 1.0;
+		common -= 1.0;
+
+		// Terms before the mode are all >= the observed one, so a negligible one is past it
+		if (term < negligible * observed)
+			break;
+
+		if (term <= observed * tie)
+			tail += term;
+
+		total += term;
+
+		if (total > 1.0 / rescale)
+		{
+			term *= rescale;
+			observed *= rescale;
+			tail *= rescale;
+			total *= rescale;
+		}
+	}
+
+	// Towards fewer hets
+	term = observed;
+	hets = het;
+	rare = std::min(hom1, hom2);
+	common = std::max(hom1, hom2);
+
+	while (hets >= 2.0)
+	{
+		term *= hets * (hets - 1.0) / (4.0 * (rare + 1.0) * (common + 1.0));
+		hets -= 2.0;
+		rare += 1.0;
+		common += 1.0;
+
+		if (term < negligible * observed)
+			break;
+
+		if (term <= observed * tie)
+			tail += term;
+
+		total += term;
+
+		if (total > 1.0 / rescale)
+		{
+			term *= rescale;
+			observed *= rescale;
+			tail *= rescale;
+			total *= rescale;
+		}
+	}
+
+	if (mid_p)
+		tail -= 0.5 * observed;
+
+	return std::min(1.0, tail / total);
+}